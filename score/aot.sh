@@ -0,0 +1,47 @@
+#!/bin/bash
+
+# compile every program of ./data and ./more-tests with --emit-cpp and check that it
+# prints the same transcript as the REPL, RuntimeError lines included, e.g.
+#   ./aot.sh ../bin/myscheme ../_build/libscheme_runtime.a
+# the optional third argument is the C++ compiler
+if [ $# -lt 2 ]; then
+    echo "usage: $0 <myscheme> <libscheme_runtime.a> [c++ compiler]"
+    exit 2
+fi
+
+MYSCHEME=$(realpath "$1")
+RUNTIME=$(realpath "$2")
+CXX=${3:-c++}
+cd "$(dirname "$0")"
+SRC=$(realpath ../src)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# check <test>: prints FAIL and the reason if the compiled program differs
+check() {
+    name=$(echo "$1" | tr '/.' '__')
+    program=$WORK/$name.scm
+    { cat "$1"; echo; echo "(exit)"; } > "$program"
+    "$MYSCHEME" < "$program" > "$WORK/$name.repl" 2>&1
+    if ! "$MYSCHEME" --emit-cpp "$program" > "$WORK/$name.cpp"; then
+        echo "FAIL $1 (emit)"
+        return
+    fi
+    if ! "$CXX" -std=c++17 -w -I"$SRC" "$WORK/$name.cpp" "$RUNTIME" -o "$WORK/$name" 2> "$WORK/$name.err"; then
+        echo "FAIL $1 (compile)"
+        head -5 "$WORK/$name.err"
+        return
+    fi
+    timeout 60 "$WORK/$name" > "$WORK/$name.aot" 2>&1
+    if ! diff "$WORK/$name.repl" "$WORK/$name.aot" > /dev/null; then
+        echo "FAIL $1"
+        diff "$WORK/$name.repl" "$WORK/$name.aot" | head -5
+    fi
+}
+export -f check
+export MYSCHEME RUNTIME CXX SRC WORK
+
+failures=$(ls ./data/*.in ./more-tests/*.in | xargs -P "$(nproc)" -I{} bash -c 'check {}' | tee /dev/stderr | grep -c '^FAIL')
+total=$(ls ./data/*.in ./more-tests/*.in | wc -l)
+echo "$((total - failures)) of $total programs match the REPL"
+[ "$failures" -eq 0 ]
@@ -0,0 +1,21 @@
+#!/bin/bash
+
+# time every program in ./bench under each set of options, e.g.
+#   ./bench.sh "" "--jit" "--engine=vm"
+if [ $# -eq 0 ]; then
+    set -- ""
+fi
+
+for f in ./bench/*.scm
+do
+    for opts in "$@"
+    do
+        start=$(date +%s%N)
+        ../bin/myscheme $opts << EOF > /dev/null
+        $(cat $f)
+        (exit)
+EOF
+        end=$(date +%s%N)
+        printf "%-12s %-16s %6d ms\n" $(basename $f) "[$opts]" $(((end - start) / 1000000))
+    done
+done
@@ -0,0 +1,2 @@
+(letrec ((loop (lambda (i acc) (if (= i 0) acc (loop (- i 1) (+ acc (* i 2)))))))
+  (loop 3000000 0))
@@ -10,7 +10,7 @@ do
     echo ""
     echo "---------------------------"
     echo "Ready to test: TEST" $i
-    ../bin/myscheme << EOF > scm.out
+    ../bin/myscheme "$@" << EOF > scm.out
     $(cat ./data/$i.in)
     (exit)
 EOF
@@ -30,13 +30,13 @@ EOF
 done
 
 L_EXTRA=1
-R_EXTRA=7
+R_EXTRA=22
 for ((i = $L_EXTRA; i <= $R_EXTRA; i = i + 1))
 do
     echo ""
     echo "---------------------------"
     echo "Ready to test: EXTRA TEST" $i
-    ../bin/myscheme << EOF > scm.out
+    ../bin/myscheme "$@" << EOF > scm.out
     $(cat ./more-tests/$i.in)
     (exit)
 EOF
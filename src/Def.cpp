@@ -1,32 +1,73 @@
 #include "Def.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include <cstdlib>
 
-std ::map<std ::string, ExprType> primitives;
 std ::map<std ::string, ExprType> reserved_words;
 
-void initPrimitives()
+/* the entries of the registry pass the argument values on to the primitive */
+template <Value (*op)(const Value&)>
+static Value unary(const Value* args, int)
 {
-    // primitives stores all procedures in library, mapping them to ExprTypes
-    primitives["*"] = E_MUL;
-    primitives["-"] = E_MINUS;
-    primitives["+"] = E_PLUS;
-    primitives["<"] = E_LT;
-    primitives["<="] = E_LE;
-    primitives["="] = E_EQ;
-    primitives[">="] = E_GE;
-    primitives[">"] = E_GT;
-    primitives["void"] = E_VOID;
-    primitives["eq?"] = E_EQQ;
-    primitives["boolean?"] = E_BOOLQ;
-    primitives["fixnum?"] = E_INTQ;
-    primitives["null?"] = E_NULLQ;
-    primitives["pair?"] = E_PAIRQ;
-    primitives["procedure?"] = E_PROCQ;
-    primitives["symbol?"] = E_SYMBOLQ;
-    primitives["cons"] = E_CONS;
-    primitives["not"] = E_NOT;
-    primitives["car"] = E_CAR;
-    primitives["cdr"] = E_CDR;
-    primitives["exit"] = E_EXIT;
+    return op(args[0]);
+}
+template <Value (*op)(const Value&, const Value&)>
+static Value binary(const Value* args, int)
+{
+    return op(args[0], args[1]);
+}
+
+/* the registry of the procedures in library */
+static const Primitive primitives[] = {
+    { "*", E_MUL, 2, 2, binary<primMult> },
+    { "-", E_MINUS, 2, 2, binary<primMinus> },
+    { "+", E_PLUS, 2, 2, binary<primPlus> },
+    { "<", E_LT, 2, 2, binary<primLess> },
+    { "<=", E_LE, 2, 2, binary<primLessEq> },
+    { "=", E_EQ, 2, 2, binary<primEqual> },
+    { ">=", E_GE, 2, 2, binary<primGreaterEq> },
+    { ">", E_GT, 2, 2, binary<primGreater> },
+    { "void", E_VOID, 0, 0, [](const Value*, int) { return VoidV(); } },
+    { "eq?", E_EQQ, 2, 2, binary<primIsEq> },
+    { "boolean?", E_BOOLQ, 1, 1, unary<primIsBoolean> },
+    { "fixnum?", E_INTQ, 1, 1, unary<primIsFixnum> },
+    { "null?", E_NULLQ, 1, 1, unary<primIsNull> },
+    { "pair?", E_PAIRQ, 1, 1, unary<primIsPair> },
+    { "procedure?", E_PROCQ, 1, 1, unary<primIsProcedure> },
+    { "symbol?", E_SYMBOLQ, 1, 1, unary<primIsSymbol> },
+    { "cons", E_CONS, 2, 2, binary<primCons> },
+    { "not", E_NOT, 1, 1, unary<primNot> },
+    { "car", E_CAR, 1, 1, unary<primCar> },
+    { "cdr", E_CDR, 1, 1, unary<primCdr> },
+    /* the tree evaluator's, the other engines call their own */
+    { "call/cc", E_CALLCC, 1, 1, unary<primCallCC> },
+    { "call-with-current-continuation", E_CALLCC, 1, 1, unary<primCallCC> },
+    { "memoize", E_MEMO, 1, 1, unary<primMemoize> },
+    { "exit", E_EXIT, 0, 0, [](const Value*, int) -> Value { exit(0); } }
+};
+
+const Primitive* findPrimitive(const std::string& name)
+{
+    static const std::map<std::string, const Primitive*> by_name = [] {
+        std::map<std::string, const Primitive*> m;
+        for (const Primitive& p : primitives)
+            m[p.name] = &p;
+        return m;
+    }();
+    auto it = by_name.find(name);
+    return it == by_name.end() ? nullptr : it->second;
+}
+
+const Primitive* primitiveOf(ExprType op)
+{
+    static const std::vector<const Primitive*> by_op = [] {
+        std::vector<const Primitive*> v(E_GETTYPE + 1, nullptr);
+        for (const Primitive& p : primitives)
+            if (v[p.op] == nullptr)
+                v[p.op] = &p;
+        return v;
+    }();
+    return by_op[op];
 }
 
 void initReservedWords()
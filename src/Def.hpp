@@ -14,6 +14,9 @@ struct Expr;
 struct Value;
 struct AssocList;
 struct Assoc;
+struct Scope;
+struct Symbol;
+struct Code;
 
 enum ExprType {
     E_LET,
@@ -47,7 +50,17 @@ enum ExprType {
     E_PAIRQ,
     E_PROCQ,
     E_SYMBOLQ,
-    E_EXIT
+    E_CALLCC,
+    E_MEMO,
+    E_EXIT,
+    E_GETTYPE
+};
+enum SyntaxType {
+    S_NUMBER,
+    S_TRUE,
+    S_FALSE,
+    S_IDENTIFIER,
+    S_LIST
 };
 enum ValueType {
     V_INT,
@@ -60,10 +73,27 @@ enum ValueType {
     V_VOID,
     V_PRIMITIVE,
     V_TERMINATE,
-    V_NOTHING
+    V_NOTHING,
+    V_CONT,
+    V_MEMO
+};
+
+/* a procedure of the library: the node type of its calls, the range of the number
+ * of arguments it takes, and its code on the argument values. a call of the name is
+ * parsed into a node of that type, the name alone is a V_PRIMITIVE value */
+struct Primitive {
+    const char* name;
+    ExprType op;
+    int min_args;
+    int max_args;
+    Value (*call)(const Value* args, int n);
 };
+const int PRIMITIVE_MAX_ARGS = 2; // the most any primitive takes
+
+/* the primitive of a name, or of a node type; nullptr if there is none */
+const Primitive* findPrimitive(const std::string&);
+const Primitive* primitiveOf(ExprType);
 
-void initPrimitives();
 void initReservedWords();
 
 #endif
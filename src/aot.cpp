@@ -0,0 +1,111 @@
+#include "aot.hpp"
+#include "expr.hpp"
+#include <cstdio>
+#include <iostream>
+
+Value compiledLambda(int arity, CompiledBody body, const Assoc& env)
+{
+    gcMaybeCollect();
+    return Value(new Closure(arity, body, env));
+}
+
+Assoc callFrame(const Value& f, int n)
+{
+    if (f.type() == V_CONT) {
+        if (n != 1)
+            throw RuntimeError("apply: wrong number of args.");
+        return extend(1, empty());
+    }
+    if (f.type() == V_PRIMITIVE) {
+        const Primitive* primitive = static_cast<PrimitiveProc*>(f.get())->primitive;
+        if (n < primitive->min_args || n > primitive->max_args)
+            throw RuntimeError("apply: wrong number of args.");
+        return extend(n, empty());
+    }
+    if (f.type() == V_MEMO)
+        return extend(n, empty()); // its procedure is checked when it is called
+    if (f.type() != V_PROC)
+        throw RuntimeError("apply: type error.");
+    Closure* closure = static_cast<Closure*>(f.get());
+    if (closure->arity != n)
+        throw RuntimeError("apply: wrong number of args.");
+    return extend(n, closure->env);
+}
+
+static Value runCompiled(Closure*, const Assoc&);
+
+Value callCompiled(Value f, Assoc env)
+{
+    while (true) {
+        if (f.type() == V_CONT)
+            escapeTo(static_cast<Continuation*>(f.get()), env->slots()[0]);
+        if (f.type() == V_PRIMITIVE)
+            return primitive(static_cast<PrimitiveProc*>(f.get())->primitive->op, env->slots(), env->n);
+        if (f.type() == V_MEMO)
+            return callValue(f, env->slots(), env->n, runCompiled);
+        Value v = static_cast<Closure*>(f.get())->compiled(env, f);
+        if (v.bits != 0)
+            return v;
+    }
+}
+
+static Value runCompiled(Closure* closure, const Assoc& env)
+{
+    return callCompiled(Value(closure), env);
+}
+
+/* the registry's, but for call/cc, which runs compiled closures */
+Value primitive(ExprType op, const Value* args, int n)
+{
+    if (op == E_CALLCC)
+        return callEscape(args[0], runCompiled);
+    return primitiveOf(op)->call(args, n);
+}
+
+Value primitive(ExprType op, const Value& rand)
+{
+    return primitive(op, &rand, 1);
+}
+
+Value primitive(ExprType op, const Value& rand1, const Value& rand2)
+{
+    Value args[] = { rand1, rand2 };
+    return primitive(op, args, 2);
+}
+
+Value undefined(const char* name)
+{
+    throw RuntimeError(std::string(name) + ": undefined.");
+}
+
+Value syntaxError()
+{
+    throw RuntimeError("syntax error.");
+}
+
+Value exitProgram()
+{
+    exit(0);
+}
+
+int runForms(CompiledBody const* forms, int n)
+{
+    Assoc global_env = empty();
+    for (int i = 0; i < n; i++) {
+        printf("scm> ");
+        try {
+            Assoc env = global_env;
+            Value self(nullptr);
+            Value val = forms[i](env, self);
+            if (val.bits == 0)
+                val = callCompiled(std::move(self), std::move(env));
+            if (val.type() == V_TERMINATE)
+                break;
+            val.show(std ::cout);
+        } catch (const RuntimeError& RE) {
+            std ::cout << "RuntimeError";
+        }
+        puts("");
+    }
+    return 0;
+}
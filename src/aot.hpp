@@ -0,0 +1,35 @@
+#ifndef AOT
+#define AOT
+
+#include "Def.hpp"
+#include "RE.hpp"
+#include "value.hpp"
+#include <cstdlib>
+
+/* runtime support for the C++ that `myscheme --emit-cpp` writes (emit.cpp), which
+ * links against the interpreter minus main.cpp. each form and each lambda body becomes
+ * a CompiledBody, frames and values are the interpreter's, so is every error */
+
+/* a procedure of the compiled program */
+Value compiledLambda(int arity, CompiledBody, const Assoc&);
+
+/* the frame for calling f with n arguments, checked like Apply does */
+Assoc callFrame(const Value& f, int n);
+
+/* call f in the frame from callFrame, following tail calls */
+Value callCompiled(Value f, Assoc env);
+
+/* the primitives, by node type */
+Value primitive(ExprType, const Value* args, int n);
+Value primitive(ExprType, const Value&);
+Value primitive(ExprType, const Value&, const Value&);
+
+/* nodes that can only raise an error or leave */
+Value undefined(const char* name);
+Value syntaxError();
+Value exitProgram();
+
+/* read-eval-print the forms in order, with the prompts and output of the REPL */
+int runForms(CompiledBody const*, int);
+
+#endif
@@ -0,0 +1,32 @@
+#include "arena.hpp"
+#include <cstdint>
+
+Arena::Arena()
+    : cur(nullptr)
+    , end(nullptr)
+{
+}
+
+Arena::~Arena()
+{
+    for (auto it = dtors.rbegin(); it != dtors.rend(); ++it)
+        it->run(it->obj);
+    for (char* chunk : chunks)
+        ::operator delete(chunk);
+}
+
+void* Arena::allocate(size_t size, size_t align)
+{
+    uintptr_t p = (reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(uintptr_t)(align - 1);
+    if (cur == nullptr || p + size > reinterpret_cast<uintptr_t>(end)) {
+        /* oversized objects get a chunk of their own */
+        size_t chunk_size = size + align > ARENA_CHUNK_SIZE ? size + align : ARENA_CHUNK_SIZE;
+        char* chunk = static_cast<char*>(::operator new(chunk_size));
+        chunks.push_back(chunk);
+        cur = chunk;
+        end = chunk + chunk_size;
+        p = (reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(uintptr_t)(align - 1);
+    }
+    cur = reinterpret_cast<char*>(p + size);
+    return reinterpret_cast<void*>(p);
+}
@@ -0,0 +1,44 @@
+#ifndef ARENA
+#define ARENA
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* bump-pointer arena for trees that die together (the Syntax of a form once it is
+ * parsed, the Expr of a form once no closure needs it); objects are never freed one
+ * by one, the arena runs their destructors and drops its chunks in one go */
+class Arena {
+public:
+    Arena();
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t, size_t);
+
+    template <typename T, typename... argv>
+    T* make(argv&&... val)
+    {
+        T* obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<argv>(val)...);
+        if (!std::is_trivially_destructible<T>::value)
+            dtors.push_back({ obj, [](void* p) { static_cast<T*>(p)->~T(); } });
+        return obj;
+    }
+
+private:
+    struct Dtor {
+        void* obj;
+        void (*run)(void*);
+    };
+    std::vector<char*> chunks;
+    std::vector<Dtor> dtors;
+    char* cur;
+    char* end;
+};
+
+const size_t ARENA_CHUNK_SIZE = 16 * 1024;
+
+#endif
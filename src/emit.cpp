@@ -0,0 +1,444 @@
+#include "Def.hpp"
+#include "RE.hpp"
+#include "aot.hpp"
+#include "expr.hpp"
+#include "optimize.hpp"
+#include "syntax.hpp"
+#include "value.hpp"
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* --emit-cpp: every form and every lambda body becomes a CompiledBody (aot.hpp) in
+ * the generated translation unit. nodes are turned into statements that leave their
+ * value in a destination, or return it in tail position; a call in tail position
+ * hands the callee back to callCompiled instead of recursing */
+struct CppEmitter {
+    std::vector<std::string> bodies; // definitions of the CompiledBody functions
+    std::map<Symbol*, int> symbols; // quoted symbols, interned once by main
+    std::vector<std::string> literals; // quoted data, made once by main
+    std::map<ExprBase*, int> quotes; // the literal of each quote node of the form
+    int temps;
+    CppEmitter();
+    std::string body(ExprBase*);
+    std::string errorBody();
+    std::string symbol(Symbol*);
+    std::string datum(const Value&);
+    std::string literal(Quote*);
+    std::string temp(const std::string&);
+    void expr(ExprBase*, const std::string& env, const std::string& dst, bool tail, std::ostream&, int);
+};
+
+CppEmitter ::CppEmitter()
+    : temps(0)
+{
+}
+
+static std::string quoted(const std::string& s)
+{
+    std::string q = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            q.push_back('\\');
+        q.push_back(c);
+    }
+    return q + "\"";
+}
+
+static std::string typeName(ExprType t)
+{
+    switch (t) {
+    case E_MUL:
+        return "E_MUL";
+    case E_PLUS:
+        return "E_PLUS";
+    case E_MINUS:
+        return "E_MINUS";
+    case E_LT:
+        return "E_LT";
+    case E_LE:
+        return "E_LE";
+    case E_EQ:
+        return "E_EQ";
+    case E_GE:
+        return "E_GE";
+    case E_GT:
+        return "E_GT";
+    case E_CONS:
+        return "E_CONS";
+    case E_EQQ:
+        return "E_EQQ";
+    case E_NOT:
+        return "E_NOT";
+    case E_CAR:
+        return "E_CAR";
+    case E_CDR:
+        return "E_CDR";
+    case E_BOOLQ:
+        return "E_BOOLQ";
+    case E_INTQ:
+        return "E_INTQ";
+    case E_NULLQ:
+        return "E_NULLQ";
+    case E_PAIRQ:
+        return "E_PAIRQ";
+    case E_PROCQ:
+        return "E_PROCQ";
+    case E_SYMBOLQ:
+        return "E_SYMBOLQ";
+    case E_VOID:
+        return "E_VOID";
+    case E_EXIT:
+        return "E_EXIT";
+    case E_MEMO:
+        return "E_MEMO";
+    default:
+        return "E_CALLCC";
+    }
+}
+
+std::string CppEmitter::temp(const std::string& prefix)
+{
+    return prefix + std::to_string(++temps);
+}
+
+std::string CppEmitter::symbol(Symbol* s)
+{
+    auto it = symbols.find(s);
+    if (it == symbols.end())
+        it = symbols.insert({ s, symbols.size() }).first;
+    return "symbols[" + std::to_string(it->second) + "]";
+}
+
+/* the literal of a quote, the nodes an inlined call copied share it as they do in
+ * the interpreter */
+std::string CppEmitter::literal(Quote* node)
+{
+    auto it = quotes.find(node);
+    if (it == quotes.end()) {
+        it = quotes.insert({ node, literals.size() }).first;
+        literals.push_back(datum(*node->value));
+    }
+    return "*literals[" + std::to_string(it->second) + "]";
+}
+
+/* the C++ expression building a quoted datum */
+std::string CppEmitter::datum(const Value& v)
+{
+    switch (v.type()) {
+    case V_INT:
+        return "IntegerV(" + std::to_string(v.integer()) + ")";
+    case V_BOOL:
+        return v.boolean() ? "BooleanV(true)" : "BooleanV(false)";
+    case V_NULL:
+        return "NullV()";
+    case V_SYM:
+        return "SymbolV(" + symbol(static_cast<Symbol*>(v.get())) + ")";
+    case V_PAIR: {
+        Pair* pair = static_cast<Pair*>(v.get());
+        return "PairV(" + datum(pair->car) + ", " + datum(pair->cdr) + ")";
+    }
+    default:
+        return "VoidV()";
+    }
+}
+
+static void put(std::ostream& os, int indent, const std::string& dst, bool tail, const std::string& value)
+{
+    os << std::string(indent, ' ');
+    if (tail)
+        os << "return " << value << ";\n";
+    else
+        os << dst << " = " << value << ";\n";
+}
+
+void CppEmitter::expr(ExprBase* e, const std::string& env, const std::string& dst, bool tail, std::ostream& os, int indent)
+{
+    std::string pad(indent, ' ');
+    switch (e->e_type) {
+    case E_FIXNUM:
+        put(os, indent, dst, tail, "IntegerV(" + std::to_string(static_cast<Fixnum*>(e)->n) + ")");
+        return;
+    case E_TRUE:
+        put(os, indent, dst, tail, "BooleanV(true)");
+        return;
+    case E_FALSE:
+        put(os, indent, dst, tail, "BooleanV(false)");
+        return;
+    case E_VOID:
+        put(os, indent, dst, tail, "VoidV()");
+        return;
+    case E_EXIT:
+        put(os, indent, dst, tail, "exitProgram()");
+        return;
+    case E_QUOTE:
+        put(os, indent, dst, tail, literal(static_cast<Quote*>(e)));
+        return;
+    case E_VAR: {
+        Var* var = static_cast<Var*>(e);
+        if (var->depth < 0) {
+            put(os, indent, dst, tail, "undefined(" + quoted(var->x->s) + ")");
+            return;
+        }
+        std::string slot = env;
+        for (int i = 0; i < var->depth; i++)
+            slot += "->next";
+        put(os, indent, dst, tail, slot + "->slots()[" + std::to_string(var->index) + "]");
+        return;
+    }
+    case E_LAMBDA: {
+        Lambda* lambda = static_cast<Lambda*>(e);
+        std::string name = body(lambda->e.get());
+        if (!lambda->flat) {
+            put(os, indent, dst, tail, "compiledLambda(" + std::to_string(lambda->x.size()) + ", " + name + ", " + env + ")");
+            return;
+        }
+        std::string frame = temp("c");
+        os << pad << "{\n";
+        os << pad << "    Assoc " << frame << " = extend(" << lambda->captured.size() << ", empty());\n";
+        for (int i = 0; i < lambda->captured.size(); i++) {
+            std::string slot = env;
+            for (int j = 0; j < lambda->captured[i].first; j++)
+                slot += "->next";
+            os << pad << "    " << frame << "->slots()[" << i << "] = " << slot << "->slots()[" << lambda->captured[i].second << "];\n";
+        }
+        put(os, indent + 4, dst, tail, "compiledLambda(" + std::to_string(lambda->x.size()) + ", " + name + ", " + frame + ")");
+        os << pad << "}\n";
+        return;
+    }
+    case E_IF: {
+        If* node = static_cast<If*>(e);
+        std::string c = temp("c");
+        os << pad << "{\n";
+        os << pad << "    Value " << c << "(nullptr);\n";
+        expr(node->cond.get(), env, c, false, os, indent + 4);
+        os << pad << "    if (" << c << ".bits != Value::FALSE) {\n";
+        expr(node->conseq.get(), env, dst, tail, os, indent + 8);
+        os << pad << "    } else {\n";
+        expr(node->alter.get(), env, dst, tail, os, indent + 8);
+        os << pad << "    }\n";
+        os << pad << "}\n";
+        return;
+    }
+    case E_BEGIN: {
+        Begin* node = static_cast<Begin*>(e);
+        std::string t = temp("t");
+        os << pad << "{\n";
+        os << pad << "    Value " << t << "(nullptr);\n";
+        for (int i = 0; i + 1 < node->es.size(); i++)
+            expr(node->es[i].get(), env, t, false, os, indent + 4);
+        expr(node->es.back().get(), env, dst, tail, os, indent + 4);
+        os << pad << "}\n";
+        return;
+    }
+    case E_LET: {
+        Let* node = static_cast<Let*>(e);
+        std::string frame = temp("e");
+        os << pad << "{\n";
+        os << pad << "    Assoc " << frame << " = extend(" << node->bind.size() << ", " << env << ");\n";
+        for (int i = 0; i < node->bind.size(); i++)
+            expr(node->bind[i].second.get(), env, frame + "->slots()[" + std::to_string(i) + "]", false, os, indent + 4);
+        expr(node->body.get(), frame, dst, tail, os, indent + 4);
+        os << pad << "}\n";
+        return;
+    }
+    case E_LETREC: {
+        Letrec* node = static_cast<Letrec*>(e);
+        std::string frame = temp("e");
+        std::string vs = temp("v");
+        int n = node->bind.size();
+        os << pad << "{\n";
+        os << pad << "    Assoc " << frame << " = extend(" << n << ", " << env << ");\n";
+        os << pad << "    std::vector<Value> " << vs << "(" << n << ", Value(nullptr));\n";
+        os << pad << "    for (int i = 0; i < " << n << "; i++)\n";
+        os << pad << "        " << frame << "->slots()[i] = NothingV();\n";
+        for (int i = 0; i < n; i++)
+            expr(node->bind[i].second.get(), frame, vs + "[" + std::to_string(i) + "]", false, os, indent + 4);
+        os << pad << "    for (int i = 0; i < " << n << "; i++)\n";
+        os << pad << "        " << frame << "->slots()[i] = std::move(" << vs << "[i]);\n";
+        for (int i = 0; i < n; i++) {
+            Lambda* lambda = node->bind[i].second->e_type == E_LAMBDA ? static_cast<Lambda*>(node->bind[i].second.get()) : nullptr;
+            for (int j = 0; lambda != nullptr && lambda->flat && j < lambda->captured.size(); j++)
+                if (lambda->captured[j].first == 0)
+                    os << pad << "    static_cast<Closure*>(" << frame << "->slots()[" << i << "].get())->env->slots()[" << j << "] = " << frame << "->slots()[" << lambda->captured[j].second << "];\n";
+        }
+        expr(node->body.get(), frame, dst, tail, os, indent + 4);
+        os << pad << "}\n";
+        return;
+    }
+    case E_APPLY: {
+        Apply* node = static_cast<Apply*>(e);
+        std::string f = temp("f");
+        std::string frame = temp("a");
+        os << pad << "{\n";
+        os << pad << "    Value " << f << "(nullptr);\n";
+        expr(node->rator.get(), env, f, false, os, indent + 4);
+        os << pad << "    Assoc " << frame << " = callFrame(" << f << ", " << node->rand.size() << ");\n";
+        for (int i = 0; i < node->rand.size(); i++)
+            expr(node->rand[i].get(), env, frame + "->slots()[" + std::to_string(i) + "]", false, os, indent + 4);
+        if (tail) {
+            os << pad << "    self = std::move(" << f << ");\n";
+            os << pad << "    env = std::move(" << frame << ");\n";
+            os << pad << "    return Value(nullptr);\n";
+        } else {
+            put(os, indent + 4, dst, false, "callCompiled(std::move(" + f + "), std::move(" + frame + "))");
+        }
+        os << pad << "}\n";
+        return;
+    }
+    case E_MUL:
+    case E_PLUS:
+    case E_MINUS:
+    case E_LT:
+    case E_LE:
+    case E_EQ:
+    case E_GE:
+    case E_GT:
+    case E_CONS:
+    case E_EQQ: {
+        Binary* node = static_cast<Binary*>(e);
+        std::string a = temp("x");
+        std::string b = temp("y");
+        os << pad << "{\n";
+        os << pad << "    Value " << a << "(nullptr);\n";
+        os << pad << "    Value " << b << "(nullptr);\n";
+        expr(node->rand1.get(), env, a, false, os, indent + 4);
+        expr(node->rand2.get(), env, b, false, os, indent + 4);
+        std::string slow = "primitive(" + typeName(e->e_type) + ", " + a + ", " + b + ")";
+        std::string value;
+        switch (e->e_type) {
+        case E_CONS:
+        case E_EQQ:
+            value = slow;
+            break;
+        default: {
+            /* fixnums on the spot, anything else raises the error of the primitive; no
+             * check when the operands are proven to be fixnums */
+            static const std::map<ExprType, std::string> ops = {
+                { E_MUL, "IntegerV(# * #)" }, { E_PLUS, "IntegerV(# + #)" }, { E_MINUS, "IntegerV(# - #)" },
+                { E_LT, "BooleanV(# < #)" }, { E_LE, "BooleanV(# <= #)" }, { E_EQ, "BooleanV(# == #)" },
+                { E_GE, "BooleanV(# >= #)" }, { E_GT, "BooleanV(# > #)" }
+            };
+            std::string fast = ops.at(e->e_type);
+            fast.replace(fast.find('#'), 1, a + ".integer()");
+            fast.replace(fast.find('#'), 1, b + ".integer()");
+            value = node->fixnums ? fast : "(" + a + ".bits & " + b + ".bits & 1) ? " + fast + " : " + slow;
+            break;
+        }
+        }
+        put(os, indent + 4, dst, tail, value);
+        os << pad << "}\n";
+        return;
+    }
+    case E_NOT:
+    case E_CAR:
+    case E_CDR:
+    case E_BOOLQ:
+    case E_INTQ:
+    case E_NULLQ:
+    case E_PAIRQ:
+    case E_PROCQ:
+    case E_SYMBOLQ:
+    case E_MEMO:
+    case E_CALLCC: {
+        Unary* node = static_cast<Unary*>(e);
+        std::string a = temp("x");
+        os << pad << "{\n";
+        os << pad << "    Value " << a << "(nullptr);\n";
+        expr(node->rand.get(), env, a, false, os, indent + 4);
+        put(os, indent + 4, dst, tail, "primitive(" + typeName(e->e_type) + ", " + a + ")");
+        os << pad << "}\n";
+        return;
+    }
+    case E_GETTYPE:
+        if (primitiveOf(static_cast<GetType*>(e)->op) != nullptr) {
+            put(os, indent, dst, tail, "PrimitiveV(" + typeName(static_cast<GetType*>(e)->op) + ")");
+            return;
+        }
+        put(os, indent, dst, tail, "syntaxError()");
+        return;
+    default:
+        put(os, indent, dst, tail, "syntaxError()");
+        return;
+    }
+}
+
+/* a CompiledBody for e, returns its name */
+std::string CppEmitter::body(ExprBase* e)
+{
+    int index = bodies.size();
+    std::string name = "body_" + std::to_string(index);
+    bodies.push_back(""); // lambdas inside come after it
+    std::ostringstream os;
+    os << "static Value " << name << "(Assoc& env, Value& self)\n{\n";
+    expr(e, "env", "", true, os, 4);
+    os << "}\n";
+    bodies[index] = os.str();
+    return name;
+}
+
+/* a form the parser rejected fails when it is reached, as in the REPL */
+std::string CppEmitter::errorBody()
+{
+    std::string name = "body_" + std::to_string(bodies.size());
+    bodies.push_back("static Value " + name + "(Assoc& env, Value& self)\n{\n    return syntaxError();\n}\n");
+    return name;
+}
+
+int emitCpp(const char* path, std::ostream& out)
+{
+    std::ifstream is(path);
+    if (!is) {
+        std ::cerr << "cannot open " << path << std ::endl;
+        return 1;
+    }
+
+    CppEmitter em;
+    std::vector<std::string> forms;
+    while (readSpace(is).peek() != EOF) {
+        SharedPtr<ExprArena> form(new ExprArena());
+        ExprArena::current = form.get();
+        try {
+            Arena syntax_arena;
+            Syntax stx = readSyntax(is, syntax_arena);
+            Expr expr = optimize(stx->parse(nullptr));
+            em.quotes.clear();
+            forms.push_back(em.body(expr.get()));
+        } catch (const RuntimeError& RE) {
+            forms.push_back(em.errorBody());
+        }
+    }
+
+    out << "/* generated by myscheme --emit-cpp " << path << " */\n";
+    out << "#include \"aot.hpp\"\n";
+    out << "#include <vector>\n\n";
+    if (!em.symbols.empty())
+        out << "static Symbol* symbols[" << em.symbols.size() << "];\n\n";
+    if (!em.literals.empty())
+        out << "static const Value* literals[" << em.literals.size() << "];\n\n";
+    for (int i = 0; i < em.bodies.size(); i++)
+        out << "static Value body_" << i << "(Assoc& env, Value& self);\n";
+    out << "\n";
+    for (const std::string& b : em.bodies)
+        out << b << "\n";
+    out << "int main()\n{\n";
+    for (const auto& s : em.symbols)
+        out << "    symbols[" << s.second << "] = intern(" << quoted(s.first->s) << ");\n";
+
+    /* never destroyed, the pools may be gone by the time static values would be */
+    for (int i = 0; i < em.literals.size(); i++)
+        out << "    literals[" << i << "] = new Value(" << em.literals[i] << ");\n";
+    if (forms.empty()) {
+        out << "    return runForms(nullptr, 0);\n";
+    } else {
+        out << "    static CompiledBody const forms[] = {";
+        for (int i = 0; i < forms.size(); i++)
+            out << (i ? ", " : " ") << forms[i];
+        out << " };\n";
+        out << "    return runForms(forms, " << forms.size() << ");\n";
+    }
+    out << "}\n";
+    return 0;
+}
@@ -1,405 +1,1068 @@
 #include "Def.hpp"
 #include "RE.hpp"
 #include "expr.hpp"
+#include "jit.hpp"
 #include "syntax.hpp"
 #include "value.hpp"
 #include <cstring>
 #include <map>
 #include <vector>
 
-extern std ::map<std ::string, ExprType> primitives;
 extern std ::map<std ::string, ExprType> reserved_words;
 
-/* function with out list */
-Value GetType::eval(Assoc& env)
+/* a primitive outside of operator position is a value, a reserved word is not */
+Value GetType::eval(const Assoc& env)
 {
-    throw RuntimeError("syntax error.");
-    return Value(nullptr);
+    if (primitiveOf(op) == nullptr)
+        throw RuntimeError("syntax error.");
+    return PrimitiveV(op);
 }
 
-/* let expression */
-Value Let::eval(Assoc& env)
+/* default for nodes that never continue in tail position */
+ExprBase* ExprBase::evalTail(Assoc& env, Value& v)
 {
-    /* pre-calculate all value */
-    std::vector<Value> vs;
-    for (auto expr : bind) {
-        Assoc env1 = env;
-        vs.push_back(expr.second->eval(env1));
-    }
+    v = eval(env);
+    return nullptr;
+}
 
-    /* assignment */
+Value trampoline(ExprBase* e, const Assoc& env)
+{
     Assoc env1 = env;
-    for (int i = 0; i < bind.size(); i++) {
-        auto expr = bind[i];
-        env1 = extend(expr.first, vs[i], env1);
-    }
+    Value v(nullptr);
+    while (e != nullptr)
+        e = e->evalTail(env1, v);
+    return v;
+}
+
+/* let expression */
+Value Let::eval(const Assoc& env)
+{
+    return trampoline(this, env);
+}
+ExprBase* Let::evalTail(Assoc& env, Value& v)
+{
+    /* calculate all value in the outer env, straight into the new frame */
+    Assoc env1 = extend(bind.size(), env);
+    for (int i = 0; i < bind.size(); i++)
+        env1->slots()[i] = bind[i].second->eval(env);
 
-    return body->eval(env1);
+    /* the body is in tail position */
+    env = std::move(env1);
+    return body.get();
 }
 
 /* lambda expression */
-Value Lambda::eval(Assoc& env)
+Value Lambda::eval(const Assoc& env)
 {
-    return ClosureV(x, e, env);
+    return ClosureV(this, env);
 }
 
-/* for function calling */
-Value Apply::eval(Assoc& env)
+/* thrown by calling an escape continuation, caught by the call/cc that made it */
+struct Escape {
+    Continuation* k;
+    Value v;
+};
+
+void escapeTo(Continuation* k, const Value& v)
 {
-    /* find closure */
-    Assoc env1 = env;
-    Value rator_eval = rator->eval(env1);
-    Closure* closure = dynamic_cast<Closure*>(rator_eval.get());
-    if (closure == nullptr)
-        throw RuntimeError("apply: type error.");
-    if (closure->parameters.size() != rand.size())
+    if (!k->active)
+        throw RuntimeError("continuation: its call/cc has returned.");
+    throw Escape { k, v };
+}
+
+/* a call of a primitive value, with the arguments evaluated in env */
+static Value applyPrimitive(const Primitive* primitive, const std::vector<Expr>& rand, const Assoc& env)
+{
+    if (rand.size() < primitive->min_args || rand.size() > primitive->max_args)
         throw RuntimeError("apply: wrong number of args.");
+    Value args[PRIMITIVE_MAX_ARGS] = { Value(nullptr), Value(nullptr) };
+    for (int i = 0; i < rand.size(); i++)
+        args[i] = rand[i]->eval(env);
+    return primitive->call(args, rand.size());
+}
 
-    /* pre-calculate parameters */
-    std::vector<Value> vs;
-    for (auto expr : rand) {
-        Assoc env2 = env;
-        vs.push_back(expr->eval(env2));
+static Value runTree(Closure*, const Assoc&);
+
+/* for function calling */
+Value Apply::eval(const Assoc& env)
+{
+    return trampoline(this, env);
+}
+ExprBase* Apply::evalTail(Assoc& env, Value& v)
+{
+    /* find closure, a closure of the cached lambda is known to take this many args */
+    Value rator_eval = rator->eval(env);
+    Closure* closure = rator_eval.type() == V_PROC ? static_cast<Closure*>(rator_eval.get()) : nullptr;
+    if (closure == nullptr || closure->lambda != cached) {
+        if (rator_eval.type() == V_CONT) {
+            if (rand.size() != 1)
+                throw RuntimeError("apply: wrong number of args.");
+            escapeTo(static_cast<Continuation*>(rator_eval.get()), rand[0]->eval(env));
+        }
+        if (rator_eval.type() == V_PRIMITIVE) {
+            v = applyPrimitive(static_cast<PrimitiveProc*>(rator_eval.get())->primitive, rand, env);
+            return nullptr;
+        }
+        if (rator_eval.type() == V_MEMO) {
+            std::vector<Value> args;
+            for (const Expr& r : rand)
+                args.push_back(r->eval(env));
+            v = callValue(rator_eval, args.data(), args.size(), runTree);
+            return nullptr;
+        }
+        if (closure == nullptr)
+            throw RuntimeError("apply: type error.");
+        if (closure->arity != rand.size())
+            throw RuntimeError("apply: wrong number of args.");
+        cached = closure->lambda;
     }
 
-    /* apply the closure */
-    Assoc env2 = closure->env;
-    for (int i = 0; i < closure->parameters.size(); i++)
-        env2 = extend(closure->parameters[i], vs[i], env2);
-    return closure->e->eval(env2);
+    /* calculate parameters straight into the new frame */
+    Assoc env2 = extend(rand.size(), closure->env);
+    for (int i = 0; i < rand.size(); i++)
+        env2->slots()[i] = rand[i]->eval(env);
+
+    /* hot closures run natively, unless they leave the call to the tree */
+    if (jit_enabled) {
+        Value result = jitCall(rator_eval, env2);
+        if (result.bits != 0) {
+            v = std::move(result);
+            return nullptr;
+        }
+        closure = static_cast<Closure*>(rator_eval.get());
+    }
+
+    /* apply the closure: its body is in tail position, this node is not touched
+     * after v takes over the closure (and with it the arena of the body) */
+    ExprBase* body = closure->e.get();
+    env = std::move(env2);
+    v = std::move(rator_eval);
+    return body;
+}
+
+ExprBase* KnownCall::evalTail(Assoc& env, Value& v)
+{
+    /* an unassigned letrec slot raises its error on the generic path, as does a call
+     * the JIT may want to take */
+    Value& f = find(depth, index, env);
+    if (jit_enabled || (recursive && f.bits == Value::NOTHING))
+        return Apply::evalTail(env, v);
+    Closure* closure = static_cast<Closure*>(f.get());
+
+    Assoc env2 = extend(rand.size(), closure->env);
+    for (int i = 0; i < rand.size(); i++)
+        env2->slots()[i] = rand[i]->eval(env);
+
+    /* the lambda is in the form of this node, what keeps the node alive (v or the
+     * REPL) keeps the body alive, so v is left as it is */
+    ExprBase* body = closure->e.get();
+    env = std::move(env2);
+    return body;
 }
 
 /* letrec expression */
-Value Letrec::eval(Assoc& env)
+Value Letrec::eval(const Assoc& env)
+{
+    return trampoline(this, env);
+}
+
+/* the flat closures of the lambdas bound here copied the slots of the frame before
+ * they were assigned */
+void Letrec::assigned(AssocList* frame)
+{
+    for (int i = 0; i < bind.size(); i++) {
+        if (bind[i].second->e_type != E_LAMBDA)
+            continue;
+        Lambda* lambda = static_cast<Lambda*>(bind[i].second.get());
+        if (!lambda->flat)
+            continue;
+        AssocList* captured = static_cast<Closure*>(frame->slots()[i].get())->env.get();
+        for (int j = 0; j < lambda->captured.size(); j++)
+            if (lambda->captured[j].first == 0)
+                captured->slots()[j] = frame->slots()[lambda->captured[j].second];
+    }
+}
+
+ExprBase* Letrec::evalTail(Assoc& env, Value& v)
 {
     /* add definition */
-    Assoc env1 = env;
-    for (auto expr : bind)
-        env1 = extend(expr.first, Value(NothingV()), env1);
+    Assoc env1 = extend(bind.size(), env);
+    for (int i = 0; i < bind.size(); i++)
+        env1->slots()[i] = NothingV();
 
     /* pre-calculate all value */
     std::vector<Value> vs;
-    for (auto expr : bind) {
-        Assoc env2 = env1;
-        vs.push_back(expr.second->eval(env2));
-    }
+    vs.reserve(bind.size());
+    for (const auto& expr : bind)
+        vs.push_back(expr.second->eval(env1));
 
     /* assignment */
-    Assoc env2 = env1;
-    for (int i = 0; i < bind.size(); i++) {
-        auto expr = bind[i];
-        modify(expr.first, vs[i], env2);
-    }
+    for (int i = 0; i < bind.size(); i++)
+        env1->slots()[i] = std::move(vs[i]);
+    assigned(env1.get());
 
-    return body->eval(env2);
+    env = std::move(env1);
+    return body.get();
 }
 
 /* evaluation of variable */
-Value Var::eval(Assoc& env)
+Value Var::eval(const Assoc& env)
 {
-    Value v = find(x, env);
-    if (v.get() != nullptr)
-        return v;
-    else
-        throw RuntimeError(x + ": undefined.");
+    if (depth < 0)
+        throw RuntimeError(x->s + ": undefined.");
+    return find(depth, index, env);
 }
 
 /* evaluation of a fixnum */
-Value Fixnum::eval(Assoc& env)
+Value Fixnum::eval(const Assoc& env)
 {
     return IntegerV(n);
 }
 
 /* if expression */
-Value If::eval(Assoc& env)
+Value If::eval(const Assoc& env)
 {
-    Assoc env1 = env, env2 = env;
-    Value cond_eval = cond->eval(env1);
-    Boolean* bool1 = dynamic_cast<Boolean*>(cond_eval.get());
-    if (bool1 == nullptr || bool1->b == true)
-        return conseq->eval(env2);
+    return trampoline(this, env);
+}
+ExprBase* If::evalTail(Assoc& env, Value& v)
+{
+    if (cond->eval(env).bits != Value::FALSE)
+        return conseq.get();
     else
-        return alter->eval(env2);
+        return alter.get();
 }
 
 /* evaluation of #t */
-Value True::eval(Assoc& env)
+Value True::eval(const Assoc& env)
 {
     return BooleanV(true);
 }
 
 /* evaluation of #f */
-Value False::eval(Assoc& env)
+Value False::eval(const Assoc& env)
 {
     return BooleanV(false);
 }
 
 /* begin expression */
-Value Begin::eval(Assoc& env)
+Value Begin::eval(const Assoc& env)
 {
-    Value v = NothingV();
-    for (Expr expr : es) {
-        Assoc env1 = env;
-        v = expr->eval(env1);
-    }
-    return v;
+    return trampoline(this, env);
+}
+ExprBase* Begin::evalTail(Assoc& env, Value& v)
+{
+    for (int i = 0; i + 1 < es.size(); i++)
+        es[i]->eval(env);
+    return es.back().get();
 }
 
 /* quote expression */
-Value Quote_List(std::vector<Syntax>&, int, Assoc&);
-Value Quote_Singlevalue(Syntax, Assoc&);
+Value Quote_List(const std::vector<Syntax>&, int);
 
-Value Quote_List(std::vector<Syntax>& stxs, int pos, Assoc& env)
+Value Quote_List(const std::vector<Syntax>& stxs, int pos)
 {
     if (pos == stxs.size())
         return NullV();
-    return PairV(Quote_Singlevalue(stxs[pos], env), Quote_List(stxs, pos + 1, env));
+    return PairV(Quote_Singlevalue(stxs[pos]), Quote_List(stxs, pos + 1));
 }
-Value Quote_Singlevalue(Syntax s, Assoc& env)
+Value Quote_Singlevalue(const Syntax& s)
 {
+    switch (s->s_type) {
     /* a list need to be reconstructed in to pair */
-    List* list = dynamic_cast<List*>(s.get());
-    if (list != nullptr)
-        return Quote_List(list->stxs, 0, env);
+    case S_LIST:
+        return Quote_List(static_cast<List*>(s.get())->stxs, 0);
 
     /* otherwise, output directly */
-    Number* int1 = dynamic_cast<Number*>(s.get());
-    if (int1 != nullptr)
-        return IntegerV(int1->n);
-    TrueSyntax* bool1 = dynamic_cast<TrueSyntax*>(s.get());
-    if (bool1 != nullptr)
+    case S_NUMBER:
+        return IntegerV(static_cast<Number*>(s.get())->n);
+    case S_TRUE:
         return BooleanV(true);
-    FalseSyntax* bool2 = dynamic_cast<FalseSyntax*>(s.get());
-    if (bool2 != nullptr)
+    case S_FALSE:
         return BooleanV(false);
-    Identifier* id = dynamic_cast<Identifier*>(s.get());
-    if (id != nullptr)
-        return SymbolV(id->s);
+    case S_IDENTIFIER:
+        return SymbolV(static_cast<Identifier*>(s.get())->s);
+    }
 
     throw RuntimeError("quote: type error.");
     return Value(nullptr);
 }
-Value Quote::eval(Assoc& env)
+Value Quote::eval(const Assoc& env)
 {
-    Assoc env1 = env;
-    return Quote_Singlevalue(s, env1);
+    return *value;
 }
 
 /* (void) */
-Value MakeVoid::eval(Assoc& env)
+Value MakeVoid::eval(const Assoc& env)
 {
     return VoidV();
 }
 
 /* (exit) */
-Value Exit::eval(Assoc& env)
+Value Exit::eval(const Assoc& env)
 {
     exit(0);
     return Value(nullptr);
 }
 
 /* evaluation of two-operators primitive */
-Value Binary::eval(Assoc& env)
+Value Binary::eval(const Assoc& env)
 {
-    Assoc env1 = env;
-    return evalRator(rand1->eval(env1), rand2->eval(env1));
+    /* left to right, as every engine does */
+    Value v1 = rand1->eval(env);
+    return evalRator(v1, rand2->eval(env));
 }
 
 /* evaluation of single-operator primitive */
-Value Unary::eval(Assoc& env)
+Value Unary::eval(const Assoc& env)
 {
-    Assoc env1 = env;
-    return evalRator(rand->eval(env1));
+    return evalRator(rand->eval(env));
 }
 
 /* * */
-Value Mult::evalRator(const Value& rand1, const Value& rand2)
+Value primMult(const Value& rand1, const Value& rand2)
 {
     /* type check */
-    Integer* int1 = dynamic_cast<Integer*>(rand1.get());
-    Integer* int2 = dynamic_cast<Integer*>(rand2.get());
-    if (int1 == nullptr || int2 == nullptr)
+    if (rand1.type() != V_INT || rand2.type() != V_INT)
         throw RuntimeError("*: type error.");
 
-    return IntegerV(int1->n * int2->n);
+    return Mult::onInts(rand1.integer(), rand2.integer());
+}
+Value Mult::evalRator(const Value& rand1, const Value& rand2)
+{
+    return primMult(rand1, rand2);
+}
+Value Mult::onInts(int a, int b)
+{
+    return IntegerV(a * b);
 }
 
 /* + */
-Value Plus::evalRator(const Value& rand1, const Value& rand2)
+Value primPlus(const Value& rand1, const Value& rand2)
 {
     /* type check */
-    Integer* int1 = dynamic_cast<Integer*>(rand1.get());
-    Integer* int2 = dynamic_cast<Integer*>(rand2.get());
-    if (int1 == nullptr || int2 == nullptr)
+    if (rand1.type() != V_INT || rand2.type() != V_INT)
         throw RuntimeError("+: type error.");
 
-    return IntegerV(int1->n + int2->n);
+    return Plus::onInts(rand1.integer(), rand2.integer());
+}
+Value Plus::evalRator(const Value& rand1, const Value& rand2)
+{
+    return primPlus(rand1, rand2);
+}
+Value Plus::onInts(int a, int b)
+{
+    return IntegerV(a + b);
 }
 
 /* - */
-Value Minus::evalRator(const Value& rand1, const Value& rand2)
+Value primMinus(const Value& rand1, const Value& rand2)
 {
     /* type check */
-    Integer* int1 = dynamic_cast<Integer*>(rand1.get());
-    Integer* int2 = dynamic_cast<Integer*>(rand2.get());
-    if (int1 == nullptr || int2 == nullptr)
+    if (rand1.type() != V_INT || rand2.type() != V_INT)
         throw RuntimeError("-: type error.");
 
-    return IntegerV(int1->n - int2->n);
+    return Minus::onInts(rand1.integer(), rand2.integer());
+}
+Value Minus::evalRator(const Value& rand1, const Value& rand2)
+{
+    return primMinus(rand1, rand2);
+}
+Value Minus::onInts(int a, int b)
+{
+    return IntegerV(a - b);
 }
 
 /* < */
-Value Less::evalRator(const Value& rand1, const Value& rand2)
+Value primLess(const Value& rand1, const Value& rand2)
 {
     /* type check */
-    Integer* int1 = dynamic_cast<Integer*>(rand1.get());
-    Integer* int2 = dynamic_cast<Integer*>(rand2.get());
-    if (int1 == nullptr || int2 == nullptr)
+    if (rand1.type() != V_INT || rand2.type() != V_INT)
         throw RuntimeError("<: type error.");
 
-    return BooleanV(int1->n < int2->n);
+    return Less::onInts(rand1.integer(), rand2.integer());
+}
+Value Less::evalRator(const Value& rand1, const Value& rand2)
+{
+    return primLess(rand1, rand2);
+}
+Value Less::onInts(int a, int b)
+{
+    return BooleanV(a < b);
 }
 
 /* <= */
-Value LessEq::evalRator(const Value& rand1, const Value& rand2)
+Value primLessEq(const Value& rand1, const Value& rand2)
 {
     /* type check */
-    Integer* int1 = dynamic_cast<Integer*>(rand1.get());
-    Integer* int2 = dynamic_cast<Integer*>(rand2.get());
-    if (int1 == nullptr || int2 == nullptr)
+    if (rand1.type() != V_INT || rand2.type() != V_INT)
         throw RuntimeError("<=: type error.");
 
-    return BooleanV(int1->n <= int2->n);
+    return LessEq::onInts(rand1.integer(), rand2.integer());
+}
+Value LessEq::evalRator(const Value& rand1, const Value& rand2)
+{
+    return primLessEq(rand1, rand2);
+}
+Value LessEq::onInts(int a, int b)
+{
+    return BooleanV(a <= b);
 }
 
 /* = */
-Value Equal::evalRator(const Value& rand1, const Value& rand2)
+Value primEqual(const Value& rand1, const Value& rand2)
 {
     /* type check */
-    Integer* int1 = dynamic_cast<Integer*>(rand1.get());
-    Integer* int2 = dynamic_cast<Integer*>(rand2.get());
-    if (int1 == nullptr || int2 == nullptr)
+    if (rand1.type() != V_INT || rand2.type() != V_INT)
         throw RuntimeError("=: type error.");
 
-    return BooleanV(int1->n == int2->n);
+    return Equal::onInts(rand1.integer(), rand2.integer());
+}
+Value Equal::evalRator(const Value& rand1, const Value& rand2)
+{
+    return primEqual(rand1, rand2);
+}
+Value Equal::onInts(int a, int b)
+{
+    return BooleanV(a == b);
 }
 
 /* >= */
-Value GreaterEq::evalRator(const Value& rand1, const Value& rand2)
+Value primGreaterEq(const Value& rand1, const Value& rand2)
 {
     /* type check */
-    Integer* int1 = dynamic_cast<Integer*>(rand1.get());
-    Integer* int2 = dynamic_cast<Integer*>(rand2.get());
-    if (int1 == nullptr || int2 == nullptr)
+    if (rand1.type() != V_INT || rand2.type() != V_INT)
         throw RuntimeError(">=: type error.");
 
-    return BooleanV(int1->n >= int2->n);
+    return GreaterEq::onInts(rand1.integer(), rand2.integer());
+}
+Value GreaterEq::evalRator(const Value& rand1, const Value& rand2)
+{
+    return primGreaterEq(rand1, rand2);
+}
+Value GreaterEq::onInts(int a, int b)
+{
+    return BooleanV(a >= b);
 }
 
 /* > */
-Value Greater::evalRator(const Value& rand1, const Value& rand2)
+Value primGreater(const Value& rand1, const Value& rand2)
 {
     /* type check */
-    Integer* int1 = dynamic_cast<Integer*>(rand1.get());
-    Integer* int2 = dynamic_cast<Integer*>(rand2.get());
-    if (int1 == nullptr || int2 == nullptr)
+    if (rand1.type() != V_INT || rand2.type() != V_INT)
         throw RuntimeError(">: type error.");
 
-    return BooleanV(int1->n > int2->n);
+    return Greater::onInts(rand1.integer(), rand2.integer());
+}
+Value Greater::evalRator(const Value& rand1, const Value& rand2)
+{
+    return primGreater(rand1, rand2);
+}
+Value Greater::onInts(int a, int b)
+{
+    return BooleanV(a > b);
 }
 
 /* eq? */
+Value primIsEq(const Value& rand1, const Value& rand2)
+{
+    /* fixnums and booleans are immediates and symbols are interned,
+     * so comparing the handles covers every case */
+    return BooleanV(rand1 == rand2);
+}
 Value IsEq::evalRator(const Value& rand1, const Value& rand2)
 {
-    /* type check */
-    if (rand1->v_type != rand2->v_type)
-        return BooleanV(rand1.get() == rand2.get());
-
-    /* classification discussion */
-    else {
-        switch (rand1->v_type) {
-        case V_INT:
-            return BooleanV(dynamic_cast<Integer*>(rand1.get())->n == dynamic_cast<Integer*>(rand2.get())->n);
-        case V_BOOL:
-            return BooleanV(dynamic_cast<Boolean*>(rand1.get())->b == dynamic_cast<Boolean*>(rand2.get())->b);
-        case V_SYM:
-            return BooleanV(dynamic_cast<Symbol*>(rand1.get())->s == dynamic_cast<Symbol*>(rand2.get())->s);
-        default:
-            return BooleanV(rand1.get() == rand2.get());
-        }
-    }
+    return primIsEq(rand1, rand2);
 }
 
 /* cons */
-Value Cons::evalRator(const Value& rand1, const Value& rand2)
+Value primCons(const Value& rand1, const Value& rand2)
 {
     return PairV(rand1, rand2);
 }
+Value Cons::evalRator(const Value& rand1, const Value& rand2)
+{
+    return primCons(rand1, rand2);
+}
 
 /* boolean? */
+Value primIsBoolean(const Value& rand)
+{
+    return BooleanV(rand.type() == V_BOOL);
+}
 Value IsBoolean::evalRator(const Value& rand)
 {
-    return BooleanV(rand->v_type == V_BOOL);
+    return primIsBoolean(rand);
 }
 
 /* fixnum? */
+Value primIsFixnum(const Value& rand)
+{
+    return BooleanV(rand.type() == V_INT);
+}
 Value IsFixnum::evalRator(const Value& rand)
 {
-    return BooleanV(rand->v_type == V_INT);
+    return primIsFixnum(rand);
 }
 
 /* symbol? */
+Value primIsSymbol(const Value& rand)
+{
+    return BooleanV(rand.type() == V_SYM);
+}
 Value IsSymbol::evalRator(const Value& rand)
 {
-    return BooleanV(rand->v_type == V_SYM);
+    return primIsSymbol(rand);
 }
 
 /* null? */
+Value primIsNull(const Value& rand)
+{
+    return BooleanV(rand.type() == V_NULL);
+}
 Value IsNull::evalRator(const Value& rand)
 {
-    return BooleanV(rand->v_type == V_NULL);
+    return primIsNull(rand);
 }
 
 /* pair? */
+Value primIsPair(const Value& rand)
+{
+    return BooleanV(rand.type() == V_PAIR);
+}
 Value IsPair::evalRator(const Value& rand)
 {
-    return BooleanV(rand->v_type == V_PAIR);
+    return primIsPair(rand);
 }
 
 /* procedure? */
+Value primIsProcedure(const Value& rand)
+{
+    return BooleanV(rand.type() == V_PROC || rand.type() == V_CONT || rand.type() == V_PRIMITIVE || rand.type() == V_MEMO);
+}
 Value IsProcedure::evalRator(const Value& rand)
 {
-    return BooleanV(rand->v_type == V_PROC);
+    return primIsProcedure(rand);
+}
+
+/* memoize */
+Value primMemoize(const Value& rand)
+{
+    /* type check */
+    if (rand.type() != V_PROC && rand.type() != V_CONT && rand.type() != V_PRIMITIVE && rand.type() != V_MEMO)
+        throw RuntimeError("memoize: type error.");
+
+    return MemoV(rand);
+}
+Value Memoize::evalRator(const Value& rand)
+{
+    return primMemoize(rand);
+}
+
+/* call/cc, the tree evaluator hands out escape continuations */
+static Value runTree(Closure* closure, const Assoc& env)
+{
+    return trampoline(closure->e.get(), env);
+}
+Value primCallCC(const Value& rand)
+{
+    return callEscape(rand, runTree);
+}
+Value CallCC::evalRator(const Value& rand)
+{
+    return primCallCC(rand);
+}
+Value callEscape(const Value& rand, Value (*run)(Closure*, const Assoc&))
+{
+    Value k = EscapeV();
+    Continuation* cont = static_cast<Continuation*>(k.get());
+    struct Deactivate {
+        Continuation* k;
+        ~Deactivate() { k->active = false; }
+    } guard { cont };
+
+    try {
+        return callValue(rand, &k, 1, run);
+    } catch (Escape& e) {
+        if (e.k != cont)
+            throw;
+        return e.v;
+    }
+}
+Value callValue(const Value& f, const Value* args, int n, Value (*run)(Closure*, const Assoc&))
+{
+    switch (f.type()) {
+    case V_PROC: {
+        Closure* closure = static_cast<Closure*>(f.get());
+        if (closure->arity != n)
+            throw RuntimeError("apply: wrong number of args.");
+        Assoc env = extend(n, closure->env);
+        for (int i = 0; i < n; i++)
+            env->slots()[i] = args[i];
+        return run(closure, env);
+    }
+    case V_PRIMITIVE: {
+        const Primitive* primitive = static_cast<PrimitiveProc*>(f.get())->primitive;
+        if (n < primitive->min_args || n > primitive->max_args)
+            throw RuntimeError("apply: wrong number of args.");
+        if (primitive->op == E_CALLCC)
+            return callEscape(args[0], run);
+        return primitive->call(args, n);
+    }
+    case V_CONT:
+        if (n != 1)
+            throw RuntimeError("apply: wrong number of args.");
+        escapeTo(static_cast<Continuation*>(f.get()), args[0]);
+    case V_MEMO: {
+        Memo* memo = static_cast<Memo*>(f.get());
+        const Value* cached = memo->lookup(args, n);
+        if (cached != nullptr)
+            return *cached;
+        Value v = callValue(memo->f, args, n, run);
+        memo->store(args, n, v);
+        return v;
+    }
+    default:
+        throw RuntimeError("apply: type error.");
+    }
 }
 
 /* not */
+Value primNot(const Value& rand)
+{
+    return BooleanV(rand.bits == Value::FALSE);
+}
 Value Not::evalRator(const Value& rand)
 {
-    Boolean* bool1 = dynamic_cast<Boolean*>(rand.get());
-    if (bool1 != nullptr && bool1->b == false)
-        return BooleanV(true);
-    else
-        return BooleanV(false);
+    return primNot(rand);
 }
 
 /* car */
-Value Car::evalRator(const Value& rand)
+Value primCar(const Value& rand)
 {
     /* type check */
-    Pair* pair1 = dynamic_cast<Pair*>(rand.get());
-    if (pair1 == nullptr)
+    if (rand.type() != V_PAIR)
         throw RuntimeError("car: type error.");
 
-    return pair1->car;
+    return static_cast<Pair*>(rand.get())->car;
+}
+Value Car::evalRator(const Value& rand)
+{
+    return primCar(rand);
 }
 
 /* cdr */
-Value Cdr::evalRator(const Value& rand)
+Value primCdr(const Value& rand)
 {
     /* type check */
-    Pair* pair1 = dynamic_cast<Pair*>(rand.get());
-    if (pair1 == nullptr)
+    if (rand.type() != V_PAIR)
         throw RuntimeError("cdr: type error.");
 
-    return pair1->cdr;
+    return static_cast<Pair*>(rand.get())->cdr;
+}
+Value Cdr::evalRator(const Value& rand)
+{
+    return primCdr(rand);
+}
+
+/* the specialized shapes, see BinaryVarFixnum in expr.hpp */
+template <class Op, bool checked>
+Value BinaryVarFixnum<Op, checked>::eval(const Assoc& env)
+{
+    if (!checked)
+        return Op::onInts(find(depth, index, env).integer(), n);
+    return Op::evalRator(find(depth, index, env), IntegerV(n));
+}
+
+template <class Op, bool checked>
+Value BinaryVarVar<Op, checked>::eval(const Assoc& env)
+{
+    if (!checked)
+        return Op::onInts(find(depth1, index1, env).integer(), find(depth2, index2, env).integer());
+    return Op::evalRator(find(depth1, index1, env), find(depth2, index2, env));
+}
+
+template <class Op>
+Value FixnumBinary<Op>::eval(const Assoc& env)
+{
+    int n1 = this->rand1->eval(env).integer();
+    return Op::onInts(n1, this->rand2->eval(env).integer());
+}
+
+template <class Op>
+Value UnaryVar<Op>::eval(const Assoc& env)
+{
+    return Op::evalRator(find(depth, index, env));
+}
+
+#define SPECIALIZE_BINARY(Op)                   \
+    template struct BinaryVarFixnum<Op>;        \
+    template struct BinaryVarVar<Op>;           \
+    template struct BinaryVarFixnum<Op, false>; \
+    template struct BinaryVarVar<Op, false>;    \
+    template struct FixnumBinary<Op>;
+SPECIALIZE_BINARY(Mult)
+SPECIALIZE_BINARY(Plus)
+SPECIALIZE_BINARY(Minus)
+SPECIALIZE_BINARY(Less)
+SPECIALIZE_BINARY(LessEq)
+SPECIALIZE_BINARY(Equal)
+SPECIALIZE_BINARY(GreaterEq)
+SPECIALIZE_BINARY(Greater)
+template struct UnaryVar<Car>;
+template struct UnaryVar<Cdr>;
+template struct UnaryVar<IsNull>;
+template struct UnaryVar<IsPair>;
+template struct UnaryVar<Not>;
+
+/* CEK machine
+ * the control is an expression c to evaluate in env, or (c == nullptr) a value v to
+ * return to the top of the continuation stack; every node that evaluates
+ * subexpressions pushes a Kont and is resumed with their values, so the native stack
+ * stays flat whatever the recursion depth. leaves without subexpressions (variables,
+ * constants, lambda, quote) still use their eval(). */
+
+Engine engine = ENGINE_TREE;
+
+Value evaluate(const Expr& e, const Assoc& env)
+{
+    if (engine == ENGINE_CEK)
+        return evalCEK(e.get(), env);
+    if (engine == ENGINE_VM)
+        return evalVM(e.get(), env);
+    return e->eval(env);
+}
+
+Value evalCEK(ExprBase* e, const Assoc& env0)
+{
+    std::vector<Kont> stack;
+    ExprBase* c = e;
+    Assoc env = env0;
+    Value v(nullptr);
+    Value owner(nullptr);
+
+    auto push = [&](KontType k, ExprBase* node) -> Kont& {
+        stack.push_back(Kont { k, node, env, 0, empty(), Value(nullptr), owner });
+        return stack.back();
+    };
+    /* call f with the single argument arg, as call/cc does */
+    auto apply1 = [&](Value f, Value arg) {
+        /* call/cc itself passes the continuation on to arg, a memo calls its procedure
+         * (a continuation is no key) */
+        while (true) {
+            if (f.type() == V_PRIMITIVE && static_cast<PrimitiveProc*>(f.get())->primitive->op == E_CALLCC) {
+                f = std::move(arg);
+                arg = ContinuationV(stack);
+            } else if (f.type() == V_MEMO) {
+                Value next = static_cast<Memo*>(f.get())->f;
+                f = std::move(next);
+            } else {
+                break;
+            }
+        }
+        if (f.type() == V_CONT) {
+            stack = static_cast<Continuation*>(f.get())->stack;
+            v = std::move(arg);
+            c = nullptr;
+            return;
+        }
+        if (f.type() == V_PRIMITIVE) {
+            const Primitive* primitive = static_cast<PrimitiveProc*>(f.get())->primitive;
+            if (primitive->min_args > 1 || primitive->max_args < 1)
+                throw RuntimeError("apply: wrong number of args.");
+            v = primitive->call(&arg, 1);
+            c = nullptr;
+            return;
+        }
+        if (f.type() != V_PROC)
+            throw RuntimeError("call/cc: type error.");
+        Closure* closure = static_cast<Closure*>(f.get());
+        if (closure->arity != 1)
+            throw RuntimeError("apply: wrong number of args.");
+        env = extend(1, closure->env);
+        env->slots()[0] = std::move(arg);
+        c = closure->e.get();
+        owner = std::move(f);
+    };
+    /* call the memo f on the values in args: the cached value, or a K_MEMO that stores
+     * the value of its procedure, which is called on them */
+    auto callMemo = [&](Value f, Assoc args) {
+        int n = args->n;
+        while (f.type() == V_MEMO) {
+            Memo* memo = static_cast<Memo*>(f.get());
+            const Value* cached = memo->lookup(args->slots(), n);
+            if (cached != nullptr) {
+                v = *cached;
+                c = nullptr;
+                return;
+            }
+            Kont& k = push(K_MEMO, nullptr);
+            k.frame = args;
+            k.v = f;
+            Value next = memo->f;
+            f = std::move(next);
+        }
+        if (f.type() == V_PROC) {
+            Closure* closure = static_cast<Closure*>(f.get());
+            if (closure->arity != n)
+                throw RuntimeError("apply: wrong number of args.");
+            env = extend(n, closure->env);
+            for (int i = 0; i < n; i++)
+                env->slots()[i] = args->slots()[i];
+            c = closure->e.get();
+            owner = std::move(f);
+            return;
+        }
+        if (f.type() == V_CONT) {
+            if (n != 1)
+                throw RuntimeError("apply: wrong number of args.");
+            stack = static_cast<Continuation*>(f.get())->stack;
+            v = args->slots()[0];
+            c = nullptr;
+            return;
+        }
+        const Primitive* primitive = static_cast<PrimitiveProc*>(f.get())->primitive;
+        if (n < primitive->min_args || n > primitive->max_args)
+            throw RuntimeError("apply: wrong number of args.");
+        if (primitive->op == E_CALLCC) {
+            apply1(args->slots()[0], ContinuationV(stack));
+            return;
+        }
+        v = primitive->call(args->slots(), n);
+        c = nullptr;
+    };
+
+    while (true) {
+        /* evaluate c in env */
+        if (c != nullptr) {
+            switch (c->e_type) {
+            case E_IF:
+                push(K_IF, c);
+                c = static_cast<If*>(c)->cond.get();
+                continue;
+            case E_BEGIN: {
+                Begin* node = static_cast<Begin*>(c);
+                if (node->es.size() > 1)
+                    push(K_BEGIN, c);
+                c = node->es[0].get();
+                continue;
+            }
+            case E_LET: {
+                Let* node = static_cast<Let*>(c);
+                Assoc frame = extend(node->bind.size(), env);
+                if (node->bind.empty()) {
+                    env = std::move(frame);
+                    c = node->body.get();
+                    continue;
+                }
+                push(K_LET, c).frame = std::move(frame);
+                c = node->bind[0].second.get();
+                continue;
+            }
+            case E_LETREC: {
+                Letrec* node = static_cast<Letrec*>(c);
+                env = extend(node->bind.size(), env);
+                for (int i = 0; i < node->bind.size(); i++)
+                    env->slots()[i] = NothingV();
+                if (node->bind.empty()) {
+                    c = node->body.get();
+                    continue;
+                }
+                push(K_LETREC, c).frame = extend(node->bind.size(), empty());
+                c = node->bind[0].second.get();
+                continue;
+            }
+            case E_APPLY:
+                push(K_RATOR, c);
+                c = static_cast<Apply*>(c)->rator.get();
+                continue;
+            case E_CALLCC:
+                push(K_CALLCC, c);
+                c = static_cast<CallCC*>(c)->rand.get();
+                continue;
+            default:
+                if (isBinary(c->e_type)) {
+                    push(K_BINARY, c);
+                    c = static_cast<Binary*>(c)->rand1.get();
+                } else if (isUnary(c->e_type)) {
+                    push(K_UNARY, c);
+                    c = static_cast<Unary*>(c)->rand.get();
+                } else {
+                    v = c->eval(env);
+                    c = nullptr;
+                }
+                continue;
+            }
+        }
+
+        /* return v to the top frame */
+        if (stack.empty())
+            return v;
+        Kont& k = stack.back();
+        switch (k.k) {
+        case K_IF: {
+            If* node = static_cast<If*>(k.e);
+            c = v == BooleanV(false) ? node->alter.get() : node->conseq.get();
+            env = std::move(k.env);
+            owner = std::move(k.owner);
+            stack.pop_back();
+            break;
+        }
+        case K_BEGIN: {
+            Begin* node = static_cast<Begin*>(k.e);
+            c = node->es[++k.i].get();
+            env = k.env;
+            owner = k.owner;
+            if (k.i + 1 == node->es.size()) // the last one is in tail position
+                stack.pop_back();
+            break;
+        }
+        case K_LET: {
+            Let* node = static_cast<Let*>(k.e);
+            k.frame->slots()[k.i++] = std::move(v);
+            if (k.i < node->bind.size()) {
+                c = node->bind[k.i].second.get();
+                env = k.env;
+                owner = k.owner;
+                break;
+            }
+            c = node->body.get();
+            env = std::move(k.frame);
+            owner = std::move(k.owner);
+            stack.pop_back();
+            break;
+        }
+        case K_LETREC: {
+            Letrec* node = static_cast<Letrec*>(k.e);
+            k.frame->slots()[k.i++] = std::move(v);
+            if (k.i < node->bind.size()) {
+                c = node->bind[k.i].second.get();
+                env = k.env;
+                owner = k.owner;
+                break;
+            }
+            for (int i = 0; i < node->bind.size(); i++)
+                k.env->slots()[i] = std::move(k.frame->slots()[i]);
+            node->assigned(k.env.get());
+            c = node->body.get();
+            env = std::move(k.env);
+            owner = std::move(k.owner);
+            stack.pop_back();
+            break;
+        }
+        case K_RATOR: {
+            Apply* node = static_cast<Apply*>(k.e);
+            if (v.type() == V_CONT) {
+                if (node->rand.size() != 1)
+                    throw RuntimeError("apply: wrong number of args.");
+                k.frame = extend(1, empty());
+            } else if (v.type() == V_PRIMITIVE) {
+                /* the arguments are collected in a frame, as for a continuation */
+                const Primitive* primitive = static_cast<PrimitiveProc*>(v.get())->primitive;
+                if (node->rand.size() < primitive->min_args || node->rand.size() > primitive->max_args)
+                    throw RuntimeError("apply: wrong number of args.");
+                if (node->rand.empty()) {
+                    v = primitive->call(nullptr, 0);
+                    stack.pop_back();
+                    break;
+                }
+                k.frame = extend(node->rand.size(), empty());
+            } else if (v.type() == V_MEMO) {
+                if (node->rand.empty()) {
+                    Value memo = std::move(v);
+                    stack.pop_back();
+                    callMemo(std::move(memo), extend(0, empty()));
+                    break;
+                }
+                k.frame = extend(node->rand.size(), empty());
+            } else {
+                if (v.type() != V_PROC)
+                    throw RuntimeError("apply: type error.");
+                Closure* closure = static_cast<Closure*>(v.get());
+                if (closure->arity != node->rand.size())
+                    throw RuntimeError("apply: wrong number of args.");
+                if (node->rand.empty()) {
+                    c = closure->e.get();
+                    env = extend(0, closure->env);
+                    owner = std::move(v);
+                    stack.pop_back();
+                    break;
+                }
+                k.frame = extend(node->rand.size(), closure->env);
+            }
+            k.k = K_RAND;
+            k.v = std::move(v);
+            c = node->rand[0].get();
+            env = k.env;
+            owner = k.owner;
+            break;
+        }
+        case K_RAND: {
+            Apply* node = static_cast<Apply*>(k.e);
+            k.frame->slots()[k.i++] = std::move(v);
+            if (k.i < node->rand.size()) {
+                c = node->rand[k.i].get();
+                env = k.env;
+                owner = k.owner;
+                break;
+            }
+            Value callee = std::move(k.v);
+            Assoc frame = std::move(k.frame);
+            stack.pop_back();
+            if (callee.type() == V_CONT) {
+                stack = static_cast<Continuation*>(callee.get())->stack;
+                v = frame->slots()[0];
+                c = nullptr;
+                break;
+            }
+            if (callee.type() == V_PRIMITIVE) {
+                const Primitive* primitive = static_cast<PrimitiveProc*>(callee.get())->primitive;
+                if (primitive->op == E_CALLCC) {
+                    apply1(frame->slots()[0], ContinuationV(stack));
+                    break;
+                }
+                v = primitive->call(frame->slots(), node->rand.size());
+                c = nullptr;
+                break;
+            }
+            if (callee.type() == V_MEMO) {
+                callMemo(std::move(callee), std::move(frame));
+                break;
+            }
+            c = static_cast<Closure*>(callee.get())->e.get();
+            env = std::move(frame);
+            owner = std::move(callee);
+            break;
+        }
+        case K_BINARY: {
+            Binary* node = static_cast<Binary*>(k.e);
+            if (k.i == 0) {
+                k.i = 1;
+                k.v = std::move(v);
+                c = node->rand2.get();
+                env = k.env;
+                owner = k.owner;
+                break;
+            }
+            v = node->evalRator(k.v, v);
+            stack.pop_back();
+            break;
+        }
+        case K_UNARY:
+            v = static_cast<Unary*>(k.e)->evalRator(v);
+            stack.pop_back();
+            break;
+        case K_CALLCC: {
+            /* the continuation of the call/cc expression is the stack below it */
+            Value f = std::move(v);
+            owner = std::move(k.owner);
+            stack.pop_back();
+            apply1(std::move(f), ContinuationV(stack));
+            break;
+        }
+        case K_MEMO:
+            static_cast<Memo*>(k.v.get())->store(k.frame->slots(), k.frame->n, v);
+            stack.pop_back();
+            break;
+        }
+    }
 }
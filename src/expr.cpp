@@ -1,5 +1,6 @@
 #include "expr.hpp"
 #include "Def.hpp"
+#include "jit.hpp"
 #include <cstring>
 #include <vector>
 using std ::pair;
@@ -12,7 +13,8 @@ ExprBase ::ExprBase(ExprType et)
 }
 
 GetType::GetType(ExprType et)
-    : ExprBase(et)
+    : ExprBase(E_GETTYPE)
+    , op(et)
 {
 }
 
@@ -20,41 +22,63 @@ Expr ::Expr(ExprBase* eb)
     : ptr(eb)
 {
 }
-ExprBase* Expr ::operator->() const { return ptr.get(); }
+ExprBase* Expr ::operator->() const { return ptr; }
 ExprBase& Expr ::operator*() { return *ptr; }
-ExprBase* Expr ::get() const { return ptr.get(); }
+ExprBase* Expr ::get() const { return ptr; }
+
+ExprArena* ExprArena::current = nullptr;
 
-Let ::Let(const vector<pair<string, Expr>>& vec, const Expr& e)
+Let ::Let(const vector<pair<Symbol*, Expr>>& vec, const Expr& e)
     : ExprBase(E_LET)
     , bind(vec)
     , body(e)
 {
 }
 
-Lambda ::Lambda(const vector<string>& vec, const Expr& expr)
+Lambda ::Lambda(const vector<Symbol*>& vec, const Expr& expr, ExprArena* f)
     : ExprBase(E_LAMBDA)
     , x(vec)
     , e(expr)
+    , form(f)
+    , code(nullptr)
+    , calls(0)
+    , native(nullptr)
+    , flat(false)
+{
+}
+Lambda ::~Lambda()
 {
+    jitFree(this);
 }
 
 Apply ::Apply(const Expr& expr, const vector<Expr>& vec)
     : ExprBase(E_APPLY)
     , rator(expr)
     , rand(vec)
+    , cached(nullptr)
 {
 }
 
-Letrec ::Letrec(const vector<pair<string, Expr>>& vec, const Expr& expr)
+KnownCall ::KnownCall(const Expr& var, const vector<Expr>& vec, bool rec)
+    : Apply(var, vec)
+    , depth(static_cast<Var*>(var.get())->depth)
+    , index(static_cast<Var*>(var.get())->index)
+    , recursive(rec)
+{
+}
+
+Letrec ::Letrec(const vector<pair<Symbol*, Expr>>& vec, const Expr& expr)
     : ExprBase(E_LETREC)
     , bind(vec)
     , body(expr)
 {
 }
 
-Var ::Var(const string& s)
+Var ::Var(Symbol* s, int d, int i)
     : ExprBase(E_VAR)
     , x(s)
+    , depth(d)
+    , index(i)
 {
 }
 
@@ -91,6 +115,7 @@ Begin ::Begin(const vector<Expr>& vec)
 Quote ::Quote(const Syntax& t)
     : ExprBase(E_QUOTE)
     , s(t)
+    , value(ExprArena::current->arena.make<Value>(Quote_Singlevalue(t)))
 {
 }
 
@@ -108,6 +133,7 @@ Binary ::Binary(ExprType et, const Expr& r1, const Expr& r2)
     : ExprBase(et)
     , rand1(r1)
     , rand2(r2)
+    , fixnums(false)
 {
 }
 
@@ -197,6 +223,16 @@ IsProcedure ::IsProcedure(const Expr& r1)
 {
 }
 
+CallCC ::CallCC(const Expr& r1)
+    : Unary(E_CALLCC, r1)
+{
+}
+
+Memoize ::Memoize(const Expr& r1)
+    : Unary(E_MEMO, r1)
+{
+}
+
 Not ::Not(const Expr& r1)
     : Unary(E_NOT, r1)
 {
@@ -210,4 +246,167 @@ Car ::Car(const Expr& r1)
 Cdr ::Cdr(const Expr& r1)
     : Unary(E_CDR, r1)
 {
-}
\ No newline at end of file
+}
+/* a variable bound by an enclosing frame */
+static bool isBound(const Expr& e)
+{
+    return e->e_type == E_VAR && static_cast<Var*>(e.get())->depth >= 0;
+}
+
+template <class Op>
+static Expr specialize(const Expr& rand1, const Expr& rand2)
+{
+    if (isBound(rand1) && rand2->e_type == E_FIXNUM)
+        return Expr(make<BinaryVarFixnum<Op>>(rand1, rand2));
+    if (isBound(rand1) && isBound(rand2))
+        return Expr(make<BinaryVarVar<Op>>(rand1, rand2));
+    return Expr(make<Op>(rand1, rand2));
+}
+template <class Op>
+static Expr specializeFixnums(const Expr& rand1, const Expr& rand2)
+{
+    if (isBound(rand1) && rand2->e_type == E_FIXNUM)
+        return Expr(make<BinaryVarFixnum<Op, false>>(rand1, rand2));
+    if (isBound(rand1) && isBound(rand2))
+        return Expr(make<BinaryVarVar<Op, false>>(rand1, rand2));
+    return Expr(make<FixnumBinary<Op>>(rand1, rand2));
+}
+template <class Op>
+static Expr specialize(const Expr& rand)
+{
+    if (isBound(rand))
+        return Expr(make<UnaryVar<Op>>(rand));
+    return Expr(make<Op>(rand));
+}
+
+Expr makeBinary(ExprType op, const Expr& rand1, const Expr& rand2)
+{
+    switch (op) {
+    case E_MUL:
+        return specialize<Mult>(rand1, rand2);
+    case E_PLUS:
+        return specialize<Plus>(rand1, rand2);
+    case E_MINUS:
+        return specialize<Minus>(rand1, rand2);
+    case E_LT:
+        return specialize<Less>(rand1, rand2);
+    case E_LE:
+        return specialize<LessEq>(rand1, rand2);
+    case E_EQ:
+        return specialize<Equal>(rand1, rand2);
+    case E_GE:
+        return specialize<GreaterEq>(rand1, rand2);
+    case E_GT:
+        return specialize<Greater>(rand1, rand2);
+    case E_EQQ:
+        return Expr(make<IsEq>(rand1, rand2));
+    case E_CONS:
+        return Expr(make<Cons>(rand1, rand2));
+    default:
+        return Expr(nullptr);
+    }
+}
+
+Expr makeFixnumBinary(ExprType op, const Expr& rand1, const Expr& rand2)
+{
+    switch (op) {
+    case E_MUL:
+        return specializeFixnums<Mult>(rand1, rand2);
+    case E_PLUS:
+        return specializeFixnums<Plus>(rand1, rand2);
+    case E_MINUS:
+        return specializeFixnums<Minus>(rand1, rand2);
+    case E_LT:
+        return specializeFixnums<Less>(rand1, rand2);
+    case E_LE:
+        return specializeFixnums<LessEq>(rand1, rand2);
+    case E_EQ:
+        return specializeFixnums<Equal>(rand1, rand2);
+    case E_GE:
+        return specializeFixnums<GreaterEq>(rand1, rand2);
+    case E_GT:
+        return specializeFixnums<Greater>(rand1, rand2);
+    default:
+        return makeBinary(op, rand1, rand2);
+    }
+}
+
+Expr makeUnary(ExprType op, const Expr& rand)
+{
+    switch (op) {
+    case E_NOT:
+        return specialize<Not>(rand);
+    case E_CAR:
+        return specialize<Car>(rand);
+    case E_CDR:
+        return specialize<Cdr>(rand);
+    case E_NULLQ:
+        return specialize<IsNull>(rand);
+    case E_PAIRQ:
+        return specialize<IsPair>(rand);
+    case E_BOOLQ:
+        return Expr(make<IsBoolean>(rand));
+    case E_INTQ:
+        return Expr(make<IsFixnum>(rand));
+    case E_PROCQ:
+        return Expr(make<IsProcedure>(rand));
+    case E_SYMBOLQ:
+        return Expr(make<IsSymbol>(rand));
+    case E_CALLCC:
+        return Expr(make<CallCC>(rand));
+    case E_MEMO:
+        return Expr(make<Memoize>(rand));
+    default:
+        return Expr(nullptr);
+    }
+}
+
+Expr makePrimitive(ExprType op, const std::vector<Expr>& rand)
+{
+    switch (rand.size()) {
+    case 0:
+        return op == E_VOID ? Expr(make<MakeVoid>()) : Expr(make<Exit>());
+    case 1:
+        return makeUnary(op, rand[0]);
+    default:
+        return makeBinary(op, rand[0], rand[1]);
+    }
+}
+
+bool isBinary(ExprType t)
+{
+    switch (t) {
+    case E_MUL:
+    case E_PLUS:
+    case E_MINUS:
+    case E_LT:
+    case E_LE:
+    case E_EQ:
+    case E_GE:
+    case E_GT:
+    case E_CONS:
+    case E_EQQ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool isUnary(ExprType t)
+{
+    switch (t) {
+    case E_NOT:
+    case E_CAR:
+    case E_CDR:
+    case E_BOOLQ:
+    case E_INTQ:
+    case E_NULLQ:
+    case E_PAIRQ:
+    case E_PROCQ:
+    case E_SYMBOLQ:
+    case E_MEMO:
+        return true;
+    default:
+        return false;
+    }
+}
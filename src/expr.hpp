@@ -11,17 +11,56 @@
 struct ExprBase {
     ExprType e_type;
     ExprBase(ExprType);
-    virtual Value eval(Assoc&) = 0;
+    virtual Value eval(const Assoc&) = 0;
+    /* one step in tail position: either store the value in v and return nullptr, or
+     * return the expression to continue with in env (v then keeps the callee alive) */
+    virtual ExprBase* evalTail(Assoc& env, Value& v);
     virtual ~ExprBase() = default;
 };
 
+/* run e and the tail positions it leads to in a loop, so tail calls take no stack */
+Value trampoline(ExprBase*, const Assoc&);
+
+/* the evaluators a form can be run with
+ * ENGINE_TREE: eval() on the nodes, recursion for non-tail calls uses the native stack
+ * ENGINE_CEK:  a machine that keeps the continuation in a heap stack, so recursion is
+ *              only limited by memory and call/cc captures re-entrant continuations
+ * ENGINE_VM:   the form is compiled to bytecode (vm.hpp) and run by a dispatch loop,
+ *              calls are kept in a heap stack, call/cc is escape-only as in the tree */
+enum Engine {
+    ENGINE_TREE,
+    ENGINE_CEK,
+    ENGINE_VM
+};
+extern Engine engine;
+
+Value evaluate(const Expr&, const Assoc&); // with the selected engine
+Value evalCEK(ExprBase*, const Assoc&);
+Value evalVM(ExprBase*, const Assoc&);
+
 struct GetType : ExprBase {
+    ExprType op; // the primitive or reserved word named
     GetType(ExprType);
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
 };
 
+/* the Expr tree of one top-level form lives in one arena, closures created from
+ * the form keep it alive */
+struct ExprArena : RefCounted {
+    Arena arena;
+    static ExprArena* current; // the form being parsed
+};
+
+/* allocate an Expr node in the form being parsed */
+template <typename T, typename... argv>
+T* make(argv&&... val)
+{
+    return ExprArena::current->arena.make<T>(std::forward<argv>(val)...);
+}
+
+/* expression nodes live in the arena of their form, the handle does not own them */
 struct Expr {
-    SharedPtr<ExprBase> ptr;
+    ExprBase* ptr;
     Expr(ExprBase*);
     ExprBase* operator->() const;
     ExprBase& operator*();
@@ -29,43 +68,68 @@ struct Expr {
 };
 
 struct Let : ExprBase {
-    std::vector<std::pair<std::string, Expr>> bind;
+    std::vector<std::pair<Symbol*, Expr>> bind;
     Expr body;
-    Let(const std ::vector<std ::pair<std ::string, Expr>>&, const Expr&);
-    virtual Value eval(Assoc&) override;
+    Let(const std ::vector<std ::pair<Symbol*, Expr>>&, const Expr&);
+    virtual Value eval(const Assoc&) override;
+    virtual ExprBase* evalTail(Assoc&, Value&) override;
 };
 
 struct Lambda : ExprBase {
-    std::vector<std::string> x;
+    std::vector<Symbol*> x;
     Expr e;
-    Lambda(const std ::vector<std ::string>&, const Expr&);
-    virtual Value eval(Assoc&) override;
+    ExprArena* form; // handed to the closures so the body outlives the REPL iteration
+    Code* code; // the body compiled for the VM, in form
+    int calls; // counted towards JIT_THRESHOLD, -1 once the JIT gave up on the body
+    void* native; // the body compiled by the JIT
+    bool flat; // its closures keep a frame of the captured slots instead of the env
+    std::vector<std::pair<int, int>> captured; // depth and index of each in the env
+    Lambda(const std ::vector<Symbol*>&, const Expr&, ExprArena*);
+    ~Lambda();
+    virtual Value eval(const Assoc&) override;
 };
 
 struct Apply : ExprBase {
     Expr rator;
     std::vector<Expr> rand;
+    Lambda* cached; // the tree evaluator's inline cache: lambda of the last closure called
     Apply(const Expr&, const std ::vector<Expr>&);
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
+    virtual ExprBase* evalTail(Assoc&, Value&) override;
 }; // this is used to handle function calling, where rator is the operator and rands are operands
 
+/* a call of a lambda bound by let or letrec, found by the optimizer: rator is the Var
+ * of its slot and the arity matches, so the closure is read straight from the slot,
+ * without a type or arity check. e_type stays E_APPLY, the other engines make the
+ * call as a plain Apply */
+struct KnownCall : Apply {
+    int depth, index; // of the slot
+    bool recursive; // bound by letrec, the slot is not assigned while the bindings run
+    KnownCall(const Expr&, const std ::vector<Expr>&, bool);
+    virtual ExprBase* evalTail(Assoc&, Value&) override;
+};
+
 struct Letrec : ExprBase {
-    std::vector<std::pair<std::string, Expr>> bind;
+    std::vector<std::pair<Symbol*, Expr>> bind;
     Expr body;
-    Letrec(const std ::vector<std ::pair<std ::string, Expr>>&, const Expr&);
-    virtual Value eval(Assoc&) override;
+    Letrec(const std ::vector<std ::pair<Symbol*, Expr>>&, const Expr&);
+    void assigned(AssocList*);
+    virtual Value eval(const Assoc&) override;
+    virtual ExprBase* evalTail(Assoc&, Value&) override;
 };
 
 struct Var : ExprBase {
-    std::string x;
-    Var(const std ::string&);
-    virtual Value eval(Assoc&) override;
+    Symbol* x;
+    int depth; // frames to walk up, -1 if x is not bound
+    int index; // slot in that frame
+    Var(Symbol*, int, int);
+    virtual Value eval(const Assoc&) override;
 };
 
 struct Fixnum : ExprBase {
     int n;
     Fixnum(int);
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
 };
 
 struct If : ExprBase {
@@ -73,94 +137,109 @@ struct If : ExprBase {
     Expr conseq;
     Expr alter;
     If(const Expr&, const Expr&, const Expr&);
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
+    virtual ExprBase* evalTail(Assoc&, Value&) override;
 };
 
 struct True : ExprBase {
     True();
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
 };
 
 struct False : ExprBase {
     False();
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
 };
 
 struct Begin : ExprBase {
     std::vector<Expr> es;
     Begin(const std ::vector<Expr>&);
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
+    virtual ExprBase* evalTail(Assoc&, Value&) override;
 };
 
+/* the datum is made into a value once, when the form is parsed, and kept in the
+ * form's arena with its other literals; every evaluation returns that value */
 struct Quote : ExprBase {
     Syntax s;
+    const Value* value;
     Quote(const Syntax&);
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
 };
+Value Quote_Singlevalue(const Syntax&);
 
 struct MakeVoid : ExprBase {
     MakeVoid();
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
 };
 
 struct Exit : ExprBase {
     Exit();
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
 };
 
 struct Binary : ExprBase {
     Expr rand1;
     Expr rand2;
+    bool fixnums; // both operands are proven to be fixnums, the type check is left out
     Binary(ExprType, const Expr&, const Expr&);
     virtual Value evalRator(const Value&, const Value&) = 0;
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
 };
 
 struct Unary : ExprBase {
     Expr rand;
     Unary(ExprType, const Expr&);
     virtual Value evalRator(const Value&) = 0;
-    virtual Value eval(Assoc&) override;
+    virtual Value eval(const Assoc&) override;
 };
 
 struct Mult : Binary {
     Mult(const Expr&, const Expr&);
     virtual Value evalRator(const Value&, const Value&) override;
+    static Value onInts(int, int);
 };
 
 struct Plus : Binary {
     Plus(const Expr&, const Expr&);
     virtual Value evalRator(const Value&, const Value&) override;
+    static Value onInts(int, int);
 };
 
 struct Minus : Binary {
     Minus(const Expr&, const Expr&);
     virtual Value evalRator(const Value&, const Value&) override;
+    static Value onInts(int, int);
 };
 
 struct Less : Binary {
     Less(const Expr&, const Expr&);
     virtual Value evalRator(const Value&, const Value&) override;
+    static Value onInts(int, int);
 };
 
 struct LessEq : Binary {
     LessEq(const Expr&, const Expr&);
     virtual Value evalRator(const Value&, const Value&) override;
+    static Value onInts(int, int);
 };
 
 struct Equal : Binary {
     Equal(const Expr&, const Expr&);
     virtual Value evalRator(const Value&, const Value&) override;
+    static Value onInts(int, int);
 };
 
 struct GreaterEq : Binary {
     GreaterEq(const Expr&, const Expr&);
     virtual Value evalRator(const Value&, const Value&) override;
+    static Value onInts(int, int);
 };
 
 struct Greater : Binary {
     Greater(const Expr&, const Expr&);
     virtual Value evalRator(const Value&, const Value&) override;
+    static Value onInts(int, int);
 };
 
 struct IsEq : Binary {
@@ -203,6 +282,17 @@ struct IsProcedure : Unary {
     virtual Value evalRator(const Value&) override;
 };
 
+struct CallCC : Unary {
+    CallCC(const Expr&);
+    virtual Value evalRator(const Value&) override;
+};
+
+/* (memoize f): f with a cache of its values, see Memo */
+struct Memoize : Unary {
+    Memoize(const Expr&);
+    virtual Value evalRator(const Value&) override;
+};
+
 struct Not : Unary {
     Not(const Expr&);
     virtual Value evalRator(const Value&) override;
@@ -218,4 +308,76 @@ struct Cdr : Unary {
     virtual Value evalRator(const Value&) override;
 };
 
+/* the parser specializes the commonest shapes of the innermost operations of a loop,
+ * (op var fixnum), (op var var) and (op var) with var bound, to read their operands
+ * in place and call the primitive directly. the nodes keep e_type and the operand
+ * nodes of Op, so everything dispatching on e_type treats them as an Op */
+template <class Op, bool checked = true>
+struct BinaryVarFixnum : Op {
+    int depth, index, n;
+    BinaryVarFixnum(const Expr& var, const Expr& fixnum)
+        : Op(var, fixnum)
+        , depth(static_cast<Var*>(var.get())->depth)
+        , index(static_cast<Var*>(var.get())->index)
+        , n(static_cast<Fixnum*>(fixnum.get())->n)
+    {
+        this->fixnums = !checked;
+    }
+    virtual Value eval(const Assoc&) override;
+};
+
+template <class Op, bool checked = true>
+struct BinaryVarVar : Op {
+    int depth1, index1, depth2, index2;
+    BinaryVarVar(const Expr& var1, const Expr& var2)
+        : Op(var1, var2)
+        , depth1(static_cast<Var*>(var1.get())->depth)
+        , index1(static_cast<Var*>(var1.get())->index)
+        , depth2(static_cast<Var*>(var2.get())->depth)
+        , index2(static_cast<Var*>(var2.get())->index)
+    {
+        this->fixnums = !checked;
+    }
+    virtual Value eval(const Assoc&) override;
+};
+
+/* an arithmetic or comparison node whose operands the optimizer proved to be fixnums
+ * (see optimize.hpp): the checked = false shapes above and this one for the others
+ * apply onInts to the operands without a type check. fixnums is set on them, the
+ * other engines leave the check out where they see it */
+template <class Op>
+struct FixnumBinary : Op {
+    FixnumBinary(const Expr& rand1, const Expr& rand2)
+        : Op(rand1, rand2)
+    {
+        this->fixnums = true;
+    }
+    virtual Value eval(const Assoc&) override;
+};
+
+template <class Op>
+struct UnaryVar : Op {
+    int depth, index;
+    UnaryVar(const Expr& var)
+        : Op(var)
+        , depth(static_cast<Var*>(var.get())->depth)
+        , index(static_cast<Var*>(var.get())->index)
+    {
+    }
+    virtual Value eval(const Assoc&) override;
+};
+
+/* the node of the primitive op on the operands, specialized as above when they have
+ * one of those shapes */
+Expr makeBinary(ExprType op, const Expr&, const Expr&);
+Expr makeUnary(ExprType op, const Expr&);
+/* the node of an arithmetic or comparison op on operands proven to be fixnums */
+Expr makeFixnumBinary(ExprType op, const Expr&, const Expr&);
+/* the node of a call of a primitive, the number of arguments is in its range */
+Expr makePrimitive(ExprType op, const std::vector<Expr>&);
+
+/* the primitives with a Binary / Unary node, call/cc excluded */
+bool isBinary(ExprType);
+bool isUnary(ExprType);
+
 #endif
@@ -0,0 +1,244 @@
+#include "gc.hpp"
+#include "value.hpp"
+#include <vector>
+
+static GcNode head(GC_FRAME); // sentinel of the tracked list
+static GcStats stats = { 0, 0, GC_MIN_THRESHOLD, 0, 0 };
+
+GcNode::GcNode(GcKind kind)
+    : gc_refs(0)
+    , gc_kind(kind)
+{
+    if (this == &head) {
+        gc_prev = gc_next = this;
+        return;
+    }
+    gc_prev = &head;
+    gc_next = head.gc_next;
+    head.gc_next->gc_prev = this;
+    head.gc_next = this;
+    stats.tracked++;
+    stats.allocated++;
+}
+
+GcNode::~GcNode()
+{
+    if (this == &head)
+        return;
+    gc_prev->gc_next = gc_next;
+    gc_next->gc_prev = gc_prev;
+    stats.tracked--;
+}
+
+static RefCounted* counted(GcNode* node)
+{
+    switch (node->gc_kind) {
+    case GC_PAIR:
+        return static_cast<Pair*>(node);
+    case GC_CLOSURE:
+        return static_cast<Closure*>(node);
+    case GC_CONT:
+        return static_cast<Continuation*>(node);
+    case GC_MEMO:
+        return static_cast<Memo*>(node);
+    default:
+        return static_cast<AssocList*>(node);
+    }
+}
+
+static GcNode* tracked(const Value& v)
+{
+    if (!v.boxed())
+        return nullptr;
+    switch (v->v_type) {
+    case V_PAIR:
+        return static_cast<Pair*>(v.get());
+    case V_PROC:
+        return static_cast<Closure*>(v.get());
+    case V_CONT:
+        return static_cast<Continuation*>(v.get());
+    case V_MEMO:
+        return static_cast<Memo*>(v.get());
+    default:
+        return nullptr;
+    }
+}
+
+static GcNode* tracked(const Assoc& env)
+{
+    return env.get();
+}
+
+/* call f on every tracked object node refers to */
+template <typename F>
+static void traverse(GcNode* node, F f)
+{
+    auto visit = [&](GcNode* child) {
+        if (child != nullptr)
+            f(child);
+    };
+    switch (node->gc_kind) {
+    case GC_PAIR: {
+        Pair* pair = static_cast<Pair*>(node);
+        visit(tracked(pair->car));
+        visit(tracked(pair->cdr));
+        break;
+    }
+    case GC_CLOSURE:
+        visit(tracked(static_cast<Closure*>(node)->env));
+        break;
+    case GC_FRAME: {
+        AssocList* frame = static_cast<AssocList*>(node);
+        visit(tracked(frame->next));
+        for (int i = 0; i < frame->n; i++)
+            visit(tracked(frame->slots()[i]));
+        break;
+    }
+    case GC_CONT:
+        for (const Kont& k : static_cast<Continuation*>(node)->stack) {
+            visit(tracked(k.env));
+            visit(tracked(k.frame));
+            visit(tracked(k.v));
+            visit(tracked(k.owner));
+        }
+        break;
+    case GC_MEMO: {
+        Memo* memo = static_cast<Memo*>(node);
+        visit(tracked(memo->f));
+        for (const auto& entry : memo->cache)
+            visit(tracked(entry.second));
+        break;
+    }
+    }
+}
+
+/* drop every reference node holds, breaking the cycles it is part of */
+static void clear(GcNode* node)
+{
+    switch (node->gc_kind) {
+    case GC_PAIR: {
+        Pair* pair = static_cast<Pair*>(node);
+        pair->car = NullV();
+        pair->cdr = NullV();
+        break;
+    }
+    case GC_CLOSURE:
+        static_cast<Closure*>(node)->env = empty();
+        break;
+    case GC_FRAME: {
+        AssocList* frame = static_cast<AssocList*>(node);
+        frame->next = empty();
+        for (int i = 0; i < frame->n; i++)
+            frame->slots()[i] = NullV();
+        break;
+    }
+    case GC_CONT:
+        static_cast<Continuation*>(node)->stack.clear();
+        break;
+    case GC_MEMO:
+        static_cast<Memo*>(node)->f = NullV();
+        static_cast<Memo*>(node)->cache.clear();
+        static_cast<Memo*>(node)->order.clear();
+        break;
+    }
+}
+
+static void release(GcNode* node)
+{
+    switch (node->gc_kind) {
+    case GC_PAIR: {
+        Pair* pair = static_cast<Pair*>(node);
+        if (--pair->ref_count == 0)
+            dispose(static_cast<ValueBase*>(pair));
+        break;
+    }
+    case GC_CLOSURE: {
+        Closure* closure = static_cast<Closure*>(node);
+        if (--closure->ref_count == 0)
+            dispose(static_cast<ValueBase*>(closure));
+        break;
+    }
+    case GC_FRAME: {
+        AssocList* frame = static_cast<AssocList*>(node);
+        if (--frame->ref_count == 0)
+            dispose(frame);
+        break;
+    }
+    case GC_CONT: {
+        Continuation* cont = static_cast<Continuation*>(node);
+        if (--cont->ref_count == 0)
+            dispose(static_cast<ValueBase*>(cont));
+        break;
+    }
+    case GC_MEMO: {
+        Memo* memo = static_cast<Memo*>(node);
+        if (--memo->ref_count == 0)
+            dispose(static_cast<ValueBase*>(memo));
+        break;
+    }
+    }
+}
+
+void gcCollect()
+{
+    /* references from outside the tracked heap are what remains after
+     * subtracting the ones from tracked objects */
+    for (GcNode* node = head.gc_next; node != &head; node = node->gc_next)
+        node->gc_refs = counted(node)->ref_count;
+    for (GcNode* node = head.gc_next; node != &head; node = node->gc_next)
+        traverse(node, [](GcNode* child) { child->gc_refs--; });
+
+    /* mark everything reachable from the roots */
+    std::vector<GcNode*> stack;
+    for (GcNode* node = head.gc_next; node != &head; node = node->gc_next)
+        if (node->gc_refs > 0)
+            stack.push_back(node);
+    for (GcNode* node : stack)
+        node->gc_refs = -1;
+    while (!stack.empty()) {
+        GcNode* node = stack.back();
+        stack.pop_back();
+        traverse(node, [&](GcNode* child) {
+            if (child->gc_refs != -1) {
+                child->gc_refs = -1;
+                stack.push_back(child);
+            }
+        });
+    }
+
+    /* sweep: hold the garbage while its references are cleared, then let it go */
+    std::vector<GcNode*> garbage;
+    for (GcNode* node = head.gc_next; node != &head; node = node->gc_next)
+        if (node->gc_refs != -1)
+            garbage.push_back(node);
+    for (GcNode* node : garbage)
+        counted(node)->ref_count++;
+    for (GcNode* node : garbage)
+        clear(node);
+    for (GcNode* node : garbage)
+        release(node);
+
+    stats.collections++;
+    stats.freed += garbage.size();
+    stats.allocated = 0;
+    stats.threshold = stats.tracked > GC_MIN_THRESHOLD ? stats.tracked : GC_MIN_THRESHOLD;
+}
+
+/* the heap has grown by threshold objects since the last collection */
+void gcMaybeCollect()
+{
+    if (stats.allocated >= stats.threshold)
+        gcCollect();
+}
+
+const GcStats& gcStats()
+{
+    return stats;
+}
+
+void gcShowStats(std::ostream& os)
+{
+    os << "gc: " << stats.collections << " collections, "
+       << stats.freed << " objects freed, "
+       << stats.tracked << " objects tracked" << std::endl;
+}
@@ -0,0 +1,49 @@
+#ifndef GC
+#define GC
+
+#include <cstddef>
+#include <ostream>
+
+/* cycle collector backing up reference counting
+ * letrec makes frames that hold closures pointing back at the frame, these cycles
+ * never reach a zero count. every object that can be part of a cycle (pair, closure,
+ * frame, continuation, memo) carries a GcNode and is linked into the tracked list.
+ * a collection finds the roots as the objects referenced from outside the tracked
+ * heap (the REPL's global_env, locals of the evaluator, constants in expressions):
+ * their count is larger than the number of references from tracked objects.
+ * everything not reachable from the roots is garbage and gets freed. */
+
+enum GcKind {
+    GC_PAIR,
+    GC_CLOSURE,
+    GC_FRAME,
+    GC_CONT,
+    GC_MEMO
+};
+
+struct GcNode {
+    GcNode* gc_prev;
+    GcNode* gc_next;
+    long gc_refs; // scratch count during a collection, -1 once reached from a root
+    GcKind gc_kind;
+    GcNode(GcKind);
+    GcNode(const GcNode&) = delete;
+    ~GcNode();
+};
+
+struct GcStats {
+    size_t tracked; // objects currently tracked
+    size_t allocated; // tracked objects allocated since the last collection
+    size_t threshold; // allocations that trigger the next collection
+    size_t collections;
+    size_t freed; // objects freed by the collector in total
+};
+
+const size_t GC_MIN_THRESHOLD = 10000;
+
+void gcMaybeCollect();
+void gcCollect();
+const GcStats& gcStats();
+void gcShowStats(std::ostream&);
+
+#endif
@@ -0,0 +1,416 @@
+#include "jit.hpp"
+#include "RE.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define JIT_X86_64
+#endif
+
+bool jit_enabled = false;
+
+/* native bodies take the frame of the call and return the bits of an immediate Value,
+ * JIT_BAIL when they give up, or JIT_TAIL when they end in a tail call, left in
+ * pending for jitCall to follow */
+typedef uintptr_t (*NativeBody)(AssocList*);
+const uintptr_t JIT_BAIL = 0;
+const uintptr_t JIT_TAIL = 4; // never an immediate
+
+static Value pending_callee(nullptr);
+static Assoc pending_env(nullptr);
+
+/* the frame of a call made by native code, arguments are on the native stack with
+ * the last one at args[0] */
+static bool enter(const Value& callee, const Apply* node, const uintptr_t* args, Assoc& env)
+{
+    if (callee.type() != V_PROC)
+        return false;
+    Closure* closure = static_cast<Closure*>(callee.get());
+    int n = node->rand.size();
+    if (closure->arity != n)
+        return false;
+    env = extend(n, closure->env);
+    for (int i = 0; i < n; i++)
+        env->slots()[i] = Value::immediate(args[n - 1 - i]);
+    return true;
+}
+
+/* helpers called by native code, exceptions must not unwind through it */
+static uintptr_t jitFind(AssocList* frame, int depth, int index)
+{
+    while (depth--)
+        frame = frame->next.get();
+    return frame->slots()[index].bits;
+}
+
+static uintptr_t jitApply(AssocList* frame, Apply* node, const uintptr_t* args)
+{
+    try {
+        Value callee = node->rator->eval(Assoc(frame));
+        Assoc env(nullptr);
+        if (!enter(callee, node, args, env))
+            return JIT_BAIL;
+        Value v = jitCall(callee, env);
+        if (v.bits == 0)
+            v = trampoline(static_cast<Closure*>(callee.get())->e.get(), env);
+        if (v.boxed())
+            return JIT_BAIL;
+        return v.bits;
+    } catch (...) {
+        return JIT_BAIL;
+    }
+}
+
+static uintptr_t jitTail(AssocList* frame, Apply* node, const uintptr_t* args)
+{
+    try {
+        Value callee = node->rator->eval(Assoc(frame));
+        Assoc env(nullptr);
+        if (!enter(callee, node, args, env))
+            return JIT_BAIL;
+        pending_callee = std::move(callee);
+        pending_env = std::move(env);
+        return JIT_TAIL;
+    } catch (...) {
+        return JIT_BAIL;
+    }
+}
+
+#ifdef JIT_X86_64
+
+/* code is generated by walking the body once, every value is computed into rax,
+ * operands wait on the native stack; rbx holds the frame
+ *   push rbp; mov rbp, rsp; push rbx; push r12   (r12 only keeps rsp aligned)
+ * every exit restores rsp from rbp, so the stack can be left dirty */
+struct Emitter {
+    std::vector<uint8_t> buf;
+    std::vector<size_t> bails; // rel32 operands that jump to the bail exit
+    int depth; // words pushed since the prologue
+    Emitter();
+    void bytes(std::initializer_list<uint8_t>);
+    void imm32(int32_t);
+    void imm64(uint64_t);
+    size_t jump(std::initializer_list<uint8_t>); // a rel32 jump, returns its operand
+    void patch(size_t); // land the jump here
+    void bail(std::initializer_list<uint8_t>);
+    void leave();
+    void call(void*);
+    bool expr(ExprBase*, bool);
+};
+
+Emitter ::Emitter()
+    : depth(0)
+{
+}
+
+void Emitter::bytes(std::initializer_list<uint8_t> bs)
+{
+    buf.insert(buf.end(), bs);
+}
+
+void Emitter::imm32(int32_t x)
+{
+    uint8_t b[4];
+    memcpy(b, &x, 4);
+    buf.insert(buf.end(), b, b + 4);
+}
+
+void Emitter::imm64(uint64_t x)
+{
+    uint8_t b[8];
+    memcpy(b, &x, 8);
+    buf.insert(buf.end(), b, b + 8);
+}
+
+size_t Emitter::jump(std::initializer_list<uint8_t> op)
+{
+    bytes(op);
+    imm32(0);
+    return buf.size() - 4;
+}
+
+void Emitter::patch(size_t at)
+{
+    int32_t rel = buf.size() - (at + 4);
+    memcpy(&buf[at], &rel, 4);
+}
+
+void Emitter::bail(std::initializer_list<uint8_t> jcc)
+{
+    bails.push_back(jump(jcc));
+}
+
+void Emitter::leave()
+{
+    bytes({ 0x48, 0x8D, 0x65, 0xF0 }); // lea rsp, [rbp - 16]
+    bytes({ 0x41, 0x5C }); // pop r12
+    bytes({ 0x5B }); // pop rbx
+    bytes({ 0x5D }); // pop rbp
+    bytes({ 0xC3 }); // ret
+}
+
+/* call fn with the arguments already in rdi, rsi, rdx, aligning rsp to 16 */
+void Emitter::call(void* fn)
+{
+    if (depth % 2)
+        bytes({ 0x48, 0x83, 0xEC, 0x08 }); // sub rsp, 8
+    bytes({ 0x48, 0xB8 }); // mov rax, fn
+    imm64(reinterpret_cast<uint64_t>(fn));
+    bytes({ 0xFF, 0xD0 }); // call rax
+    if (depth % 2)
+        bytes({ 0x48, 0x83, 0xC4, 0x08 }); // add rsp, 8
+}
+
+/* boolean of the flags: setcc al; movzx eax, al; lea eax, [rax * 4 + FALSE] */
+static void setBoolean(Emitter& em, uint8_t setcc)
+{
+    em.bytes({ 0x0F, setcc, 0xC0 });
+    em.bytes({ 0x0F, 0xB6, 0xC0 });
+    em.bytes({ 0x8D, 0x04, 0x85 });
+    em.imm32(Value::FALSE);
+    static_assert(Value::TRUE - Value::FALSE == 4, "booleans differ in bit 2");
+}
+
+/* false if the node is out of reach of the JIT */
+bool Emitter::expr(ExprBase* e, bool tail)
+{
+    switch (e->e_type) {
+    case E_FIXNUM:
+        bytes({ 0x48, 0xB8 }); // mov rax, imm64
+        imm64(IntegerV(static_cast<Fixnum*>(e)->n).bits);
+        break;
+    case E_TRUE:
+    case E_FALSE:
+    case E_VOID:
+        bytes({ 0x48, 0xB8 });
+        imm64(e->e_type == E_TRUE ? Value::TRUE : e->e_type == E_FALSE ? Value::FALSE : Value::VOID);
+        break;
+    case E_VAR: {
+        Var* var = static_cast<Var*>(e);
+        if (var->depth < 0)
+            return false;
+        if (var->depth == 0) {
+            bytes({ 0x48, 0x8B, 0x83 }); // mov rax, [rbx + slot]
+            imm32(sizeof(AssocList) + var->index * sizeof(Value));
+        } else {
+            bytes({ 0x48, 0x89, 0xDF }); // mov rdi, rbx
+            bytes({ 0xBE }); // mov esi, depth
+            imm32(var->depth);
+            bytes({ 0xBA }); // mov edx, index
+            imm32(var->index);
+            call(reinterpret_cast<void*>(jitFind));
+        }
+        bytes({ 0xA8, 0x03 }); // test al, 3
+        bail({ 0x0F, 0x84 }); // jz: a pointer, give up
+        break;
+    }
+    case E_IF: {
+        If* node = static_cast<If*>(e);
+        if (!expr(node->cond.get(), false))
+            return false;
+        bytes({ 0x48, 0x83, 0xF8, Value::FALSE }); // cmp rax, #f
+        size_t to_alter = jump({ 0x0F, 0x84 }); // je
+        if (!expr(node->conseq.get(), tail))
+            return false;
+        size_t to_end = jump({ 0xE9 }); // jmp
+        patch(to_alter);
+        if (!expr(node->alter.get(), tail))
+            return false;
+        patch(to_end);
+        return true;
+    }
+    case E_BEGIN: {
+        Begin* node = static_cast<Begin*>(e);
+        for (int i = 0; i + 1 < node->es.size(); i++)
+            if (!expr(node->es[i].get(), false))
+                return false;
+        return expr(node->es.back().get(), tail);
+    }
+    case E_APPLY: {
+        Apply* node = static_cast<Apply*>(e);
+        /* the operator is found by the helper, the arguments are pushed in order */
+        for (const Expr& rand : node->rand) {
+            if (!expr(rand.get(), false))
+                return false;
+            bytes({ 0x50 }); // push rax
+            depth++;
+        }
+        bytes({ 0x48, 0x89, 0xE2 }); // mov rdx, rsp
+        bytes({ 0x48, 0x89, 0xDF }); // mov rdi, rbx
+        bytes({ 0x48, 0xBE }); // mov rsi, node
+        imm64(reinterpret_cast<uint64_t>(node));
+        call(reinterpret_cast<void*>(tail ? jitTail : jitApply));
+        if (!node->rand.empty()) {
+            bytes({ 0x48, 0x81, 0xC4 }); // add rsp, 8n
+            imm32(node->rand.size() * 8);
+            depth -= node->rand.size();
+        }
+        bytes({ 0x48, 0x85, 0xC0 }); // test rax, rax
+        bail({ 0x0F, 0x84 }); // jz
+        if (tail) {
+            leave(); // JIT_TAIL
+            return true;
+        }
+        break;
+    }
+    case E_PLUS:
+    case E_MINUS:
+    case E_MUL:
+    case E_LT:
+    case E_LE:
+    case E_EQ:
+    case E_GE:
+    case E_GT:
+    case E_EQQ: {
+        Binary* node = static_cast<Binary*>(e);
+        if (!expr(node->rand1.get(), false))
+            return false;
+        bytes({ 0x50 }); // push rax
+        depth++;
+        if (!expr(node->rand2.get(), false))
+            return false;
+        bytes({ 0x48, 0x89, 0xC1 }); // mov rcx, rax
+        bytes({ 0x58 }); // pop rax
+        depth--;
+        if (e->e_type == E_EQQ) {
+            bytes({ 0x48, 0x39, 0xC8 }); // cmp rax, rcx
+            setBoolean(*this, 0x94); // sete
+            break;
+        }
+        /* both fixnums: the low bit of both is set, unless they are proven to be */
+        if (!node->fixnums) {
+            bytes({ 0x89, 0xC2 }); // mov edx, eax
+            bytes({ 0x21, 0xCA }); // and edx, ecx
+            bytes({ 0xF6, 0xC2, 0x01 }); // test dl, 1
+            bail({ 0x0F, 0x84 }); // jz
+        }
+        switch (e->e_type) {
+        case E_PLUS:
+        case E_MINUS:
+        case E_MUL:
+            /* untag, operate on 32 bits like IntegerV(int), tag again */
+            bytes({ 0x48, 0xD1, 0xF8 }); // sar rax, 1
+            bytes({ 0x48, 0xD1, 0xF9 }); // sar rcx, 1
+            if (e->e_type == E_PLUS)
+                bytes({ 0x01, 0xC8 }); // add eax, ecx
+            else if (e->e_type == E_MINUS)
+                bytes({ 0x29, 0xC8 }); // sub eax, ecx
+            else
+                bytes({ 0x0F, 0xAF, 0xC1 }); // imul eax, ecx
+            bytes({ 0x48, 0x63, 0xC0 }); // movsxd rax, eax
+            bytes({ 0x48, 0x8D, 0x44, 0x00, 0x01 }); // lea rax, [rax + rax + 1]
+            break;
+        default:
+            /* tagged fixnums compare like the ints they hold */
+            bytes({ 0x48, 0x39, 0xC8 }); // cmp rax, rcx
+            setBoolean(*this, e->e_type == E_LT ? 0x9C : e->e_type == E_LE ? 0x9E : e->e_type == E_EQ ? 0x94 : e->e_type == E_GE ? 0x9D : 0x9F);
+            break;
+        }
+        break;
+    }
+    case E_NOT:
+    case E_NULLQ:
+    case E_INTQ: {
+        if (!expr(static_cast<Unary*>(e)->rand.get(), false))
+            return false;
+        if (e->e_type == E_INTQ) {
+            bytes({ 0xA8, 0x01 }); // test al, 1
+            setBoolean(*this, 0x95); // setnz
+        } else {
+            uint8_t against = e->e_type == E_NOT ? Value::FALSE : Value::NIL;
+            bytes({ 0x48, 0x83, 0xF8, against }); // cmp rax, imm8
+            setBoolean(*this, 0x94); // sete
+        }
+        break;
+    }
+    default:
+        return false;
+    }
+    if (tail)
+        leave();
+    return true;
+}
+
+static bool compileBody(Lambda* lambda)
+{
+    Emitter em;
+    em.bytes({ 0x55 }); // push rbp
+    em.bytes({ 0x48, 0x89, 0xE5 }); // mov rbp, rsp
+    em.bytes({ 0x53 }); // push rbx
+    em.bytes({ 0x41, 0x54 }); // push r12
+    em.bytes({ 0x48, 0x89, 0xFB }); // mov rbx, rdi
+    if (!em.expr(lambda->e.get(), true))
+        return false;
+    for (size_t at : em.bails)
+        em.patch(at);
+    em.bytes({ 0x31, 0xC0 }); // xor eax, eax: JIT_BAIL
+    em.leave();
+
+    /* the size is kept in front of the code for munmap */
+    size_t size = em.buf.size() + 16;
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return false;
+    memcpy(mem, &size, sizeof(size));
+    memcpy(static_cast<char*>(mem) + 16, em.buf.data(), em.buf.size());
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return false;
+    }
+    lambda->native = static_cast<char*>(mem) + 16;
+    return true;
+}
+
+void jitFree(Lambda* lambda)
+{
+    if (lambda->native == nullptr)
+        return;
+    char* mem = static_cast<char*>(lambda->native) - 16;
+    size_t size;
+    memcpy(&size, mem, sizeof(size));
+    munmap(mem, size);
+    lambda->native = nullptr;
+}
+
+#else
+
+static bool compileBody(Lambda*)
+{
+    return false;
+}
+
+void jitFree(Lambda*)
+{
+}
+
+#endif
+
+Value jitCall(Value& callee, Assoc& env)
+{
+    while (true) {
+        Lambda* lambda = static_cast<Closure*>(callee.get())->lambda;
+        if (lambda->calls < 0)
+            return Value(nullptr);
+        if (lambda->native == nullptr) {
+            if (++lambda->calls < JIT_THRESHOLD)
+                return Value(nullptr);
+            if (!compileBody(lambda)) {
+                lambda->calls = -1;
+                return Value(nullptr);
+            }
+        }
+
+        uintptr_t r = reinterpret_cast<NativeBody>(lambda->native)(env.get());
+        if (r == JIT_BAIL) {
+            /* frames further up may still be running the code, it is freed with the lambda */
+            lambda->calls = -1;
+            return Value(nullptr);
+        }
+        if (r != JIT_TAIL)
+            return Value::immediate(r);
+        callee = std::move(pending_callee);
+        env = std::move(pending_env);
+    }
+}
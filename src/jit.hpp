@@ -0,0 +1,25 @@
+#ifndef JIT
+#define JIT
+
+#include "Def.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+
+/* baseline JIT for the tree evaluator: once a lambda has been called JIT_THRESHOLD
+ * times its body is compiled to x86-64 code, provided it only uses fixnums and
+ * booleans, variables, if, begin, arithmetic, comparisons and calls. the code checks
+ * the types as it goes and gives up on any other value, the call is then evaluated
+ * again by the tree (the language has no side effects to repeat) and the lambda is
+ * not run natively any more */
+extern bool jit_enabled;
+const int JIT_THRESHOLD = 64;
+
+/* run the call of closure callee on frame env natively, with the tail calls it makes;
+ * returns an unset Value when the call is left to the interpreter, callee and env then
+ * hold the call to evaluate (a tail call may have moved on to another closure) */
+Value jitCall(Value& callee, Assoc& env);
+
+/* release the native code of a lambda */
+void jitFree(Lambda*);
+
+#endif
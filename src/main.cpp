@@ -1,29 +1,41 @@
 #include "Def.hpp"
 #include "RE.hpp"
 #include "expr.hpp"
+#include "gc.hpp"
+#include "jit.hpp"
+#include "optimize.hpp"
 #include "syntax.hpp"
 #include "value.hpp"
 #include <iostream>
 #include <map>
 #include <sstream>
 
-extern std ::map<std ::string, ExprType> primitives;
 extern std ::map<std ::string, ExprType> reserved_words;
 
+int emitCpp(const char*, std ::ostream&); // emit.cpp
+
 void REPL()
 {
     // read - evaluation - print loop
     Assoc global_env = empty();
     while (1) {
         printf("scm> ");
-        Syntax stx = readSyntax(std ::cin); // read
+        /* the expression lives as long as the form or a closure made by it runs */
+        SharedPtr<ExprArena> form(new ExprArena());
+        ExprArena::current = form.get();
         try {
-            Expr expr = stx->parse(global_env); // parse
-            // stx->show(std ::cerr); // syntax print
-            Value val = expr->eval(global_env);
-            if (val->v_type == V_TERMINATE)
+            Expr expr(nullptr);
+            {
+                /* the syntax is dropped as soon as the form is parsed */
+                Arena syntax_arena;
+                Syntax stx = readSyntax(std ::cin, syntax_arena); // read
+                expr = optimize(stx->parse(nullptr)); // parse
+                // stx->show(std ::cerr); // syntax print
+            }
+            Value val = evaluate(expr, global_env);
+            if (val.type() == V_TERMINATE)
                 break;
-            val->show(std ::cout); // value print
+            val.show(std ::cout); // value print
         } catch (const RuntimeError& RE) {
             // std ::cout << RE.message();
             std ::cout << "RuntimeError";
@@ -32,10 +44,50 @@ void REPL()
     }
 }
 
+void showGcStats()
+{
+    gcShowStats(std ::cerr);
+}
+
+void showMemoStats()
+{
+    memoShowStats(std ::cerr);
+}
+
 int main(int argc, char* argv[])
 {
-    initPrimitives();
+    const char* emit_cpp = nullptr;
+    for (int i = 1; i < argc; i++) {
+        std ::string arg = argv[i];
+        if (arg == "--gc-stats")
+            atexit(showGcStats); // (exit) leaves through exit()
+        else if (arg == "--memo-stats")
+            atexit(showMemoStats);
+        else if (arg == "--engine=tree")
+            engine = ENGINE_TREE;
+        else if (arg == "--engine=cek")
+            engine = ENGINE_CEK;
+        else if (arg == "--engine=vm")
+            engine = ENGINE_VM;
+        else if (arg == "--jit")
+            jit_enabled = true;
+        else if (arg.compare(0, 16, "--inline-budget=") == 0)
+            inline_budget = atoi(arg.c_str() + 16);
+        else if (arg == "--auto-memo")
+            auto_memo = true;
+        else if (arg.compare(0, 13, "--memo-limit=") == 0) {
+            memo_limit = atoi(arg.c_str() + 13);
+            if (memo_limit <= 0) {
+                std ::cerr << "--memo-limit must be positive" << std ::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--emit-cpp" && i + 1 < argc)
+            emit_cpp = argv[++i];
+    }
     initReservedWords();
+    if (emit_cpp != nullptr)
+        return emitCpp(emit_cpp, std ::cout);
     REPL();
     return 0;
 }
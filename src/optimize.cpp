@@ -0,0 +1,1172 @@
+#include "optimize.hpp"
+#include "RE.hpp"
+#include "syntax.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <map>
+#include <vector>
+
+/* a node whose value is known, and can be rebuilt at each use: pairs and closures
+ * are not constants, each evaluation makes a new one */
+static bool isConstant(const Expr& e)
+{
+    switch (e->e_type) {
+    case E_FIXNUM:
+    case E_TRUE:
+    case E_FALSE:
+    case E_VOID:
+        return true;
+    case E_GETTYPE:
+        return primitiveOf(static_cast<GetType*>(e.get())->op) != nullptr;
+    case E_QUOTE: {
+        List* list = asList(static_cast<Quote*>(e.get())->s);
+        return list == nullptr || list->stxs.empty();
+    }
+    default:
+        return false;
+    }
+}
+
+/* the node of a constant value, nullptr if v is not one */
+static Expr constant(const Value& v)
+{
+    Arena& arena = ExprArena::current->arena;
+    switch (v.type()) {
+    case V_INT:
+        return Expr(make<Fixnum>(v.integer()));
+    case V_BOOL:
+        if (v.boolean())
+            return Expr(make<True>());
+        return Expr(make<False>());
+    case V_VOID:
+        return Expr(make<MakeVoid>());
+    case V_NULL:
+        return Expr(make<Quote>(Syntax(arena.make<List>())));
+    case V_SYM:
+        return Expr(make<Quote>(Syntax(arena.make<Identifier>(static_cast<Symbol*>(v.get())->s))));
+    case V_PRIMITIVE:
+        return Expr(make<GetType>(static_cast<PrimitiveProc*>(v.get())->primitive->op));
+    default:
+        return Expr(nullptr);
+    }
+}
+
+/* evaluating e has no effect and cannot fail */
+static bool isPure(const Expr& e)
+{
+    if (e->e_type == E_VAR)
+        return static_cast<Var*>(e.get())->depth >= 0;
+    return isConstant(e) || e->e_type == E_QUOTE || e->e_type == E_LAMBDA;
+}
+
+/* call f(child, levels) for each subexpression of e, levels is the number of frames e
+ * puts around the child */
+template <class F>
+static void forEachChild(ExprBase* e, F f)
+{
+    switch (e->e_type) {
+    case E_LET: {
+        Let* let = static_cast<Let*>(e);
+        for (const auto& b : let->bind)
+            f(b.second.get(), 0);
+        f(let->body.get(), 1);
+        return;
+    }
+    case E_LETREC: {
+        Letrec* letrec = static_cast<Letrec*>(e);
+        for (const auto& b : letrec->bind)
+            f(b.second.get(), 1);
+        f(letrec->body.get(), 1);
+        return;
+    }
+    case E_LAMBDA:
+        f(static_cast<Lambda*>(e)->e.get(), 1);
+        return;
+    case E_APPLY: {
+        Apply* apply = static_cast<Apply*>(e);
+        f(apply->rator.get(), 0);
+        for (const Expr& rand : apply->rand)
+            f(rand.get(), 0);
+        return;
+    }
+    case E_IF: {
+        If* node = static_cast<If*>(e);
+        f(node->cond.get(), 0);
+        f(node->conseq.get(), 0);
+        f(node->alter.get(), 0);
+        return;
+    }
+    case E_BEGIN:
+        for (const Expr& es : static_cast<Begin*>(e)->es)
+            f(es.get(), 0);
+        return;
+    default:
+        if (isBinary(e->e_type)) {
+            f(static_cast<Binary*>(e)->rand1.get(), 0);
+            f(static_cast<Binary*>(e)->rand2.get(), 0);
+        } else if (isUnary(e->e_type) || e->e_type == E_CALLCC) {
+            f(static_cast<Unary*>(e)->rand.get(), 0);
+        }
+        return;
+    }
+}
+
+/* count in uses the references of e to the slots of the frame depth levels up */
+static void countUses(ExprBase* e, int depth, std::vector<int>& uses)
+{
+    if (e->e_type == E_VAR) {
+        Var* var = static_cast<Var*>(e);
+        if (var->depth == depth)
+            uses[var->index]++;
+        return;
+    }
+    forEachChild(e, [&](ExprBase* child, int levels) { countUses(child, depth + levels, uses); });
+}
+
+/* e refers to a slot of the frame depth levels up */
+static bool refersTo(ExprBase* e, int depth)
+{
+    if (e->e_type == E_VAR)
+        return static_cast<Var*>(e)->depth == depth;
+    bool refers = false;
+    forEachChild(e, [&](ExprBase* child, int levels) { refers = refers || refersTo(child, depth + levels); });
+    return refers;
+}
+
+/* the number of nodes of e */
+static int size(ExprBase* e)
+{
+    int n = 1;
+    forEachChild(e, [&](ExprBase* child, int) { n += size(child); });
+    return n;
+}
+
+/* e with the variables that are free below cutoff levels moved k frames further, for
+ * an expression moved under k more frames */
+static Expr shift(const Expr& e, int cutoff, int k)
+{
+    switch (e->e_type) {
+    case E_VAR: {
+        Var* var = static_cast<Var*>(e.get());
+        if (var->depth < cutoff)
+            return e;
+        return Expr(make<Var>(var->x, var->depth + k, var->index));
+    }
+    case E_LET: {
+        Let* node = static_cast<Let*>(e.get());
+        std::vector<std::pair<Symbol*, Expr>> bind;
+        for (const auto& b : node->bind)
+            bind.push_back(std::make_pair(b.first, shift(b.second, cutoff, k)));
+        return Expr(make<Let>(bind, shift(node->body, cutoff + 1, k)));
+    }
+    case E_LETREC: {
+        Letrec* node = static_cast<Letrec*>(e.get());
+        std::vector<std::pair<Symbol*, Expr>> bind;
+        for (const auto& b : node->bind)
+            bind.push_back(std::make_pair(b.first, shift(b.second, cutoff + 1, k)));
+        return Expr(make<Letrec>(bind, shift(node->body, cutoff + 1, k)));
+    }
+    case E_LAMBDA: {
+        Lambda* node = static_cast<Lambda*>(e.get());
+        return Expr(make<Lambda>(node->x, shift(node->e, cutoff + 1, k), node->form));
+    }
+    case E_APPLY: {
+        Apply* node = static_cast<Apply*>(e.get());
+        std::vector<Expr> rand;
+        for (const Expr& r : node->rand)
+            rand.push_back(shift(r, cutoff, k));
+        return Expr(make<Apply>(shift(node->rator, cutoff, k), rand));
+    }
+    case E_IF: {
+        If* node = static_cast<If*>(e.get());
+        return Expr(make<If>(shift(node->cond, cutoff, k), shift(node->conseq, cutoff, k), shift(node->alter, cutoff, k)));
+    }
+    case E_BEGIN: {
+        std::vector<Expr> es;
+        for (const Expr& ei : static_cast<Begin*>(e.get())->es)
+            es.push_back(shift(ei, cutoff, k));
+        return Expr(make<Begin>(es));
+    }
+    default:
+        break;
+    }
+    if (isBinary(e->e_type)) {
+        Binary* node = static_cast<Binary*>(e.get());
+        Expr rand1 = shift(node->rand1, cutoff, k), rand2 = shift(node->rand2, cutoff, k);
+        return node->fixnums ? makeFixnumBinary(e->e_type, rand1, rand2) : makeBinary(e->e_type, rand1, rand2);
+    }
+    if (isUnary(e->e_type) || e->e_type == E_CALLCC)
+        return makeUnary(e->e_type, shift(static_cast<Unary*>(e.get())->rand, cutoff, k));
+    return e;
+}
+
+bool auto_memo = false;
+
+/* the scan of the lambdas of a letrec for --auto-memo */
+struct Memoizer {
+    Letrec* letrec;
+    std::vector<bool> pure; // a lambda whose body is not found impure yet
+    int calls = 0; // of the letrec's lambdas by the body scanned
+    bool tail_self = false; // it calls its own lambda in tail position
+
+    /* e, depth levels below the letrec frame, only calls pure lambdas of it */
+    bool scan(ExprBase* e, int depth, bool tail, int self)
+    {
+        switch (e->e_type) {
+        case E_LAMBDA:
+        case E_CONS:
+        case E_CALLCC:
+        case E_MEMO:
+        case E_EXIT:
+            return false;
+        case E_APPLY: {
+            Apply* node = static_cast<Apply*>(e);
+            if (node->rator->e_type != E_VAR)
+                return false;
+            Var* var = static_cast<Var*>(node->rator.get());
+            if (var->depth != depth || !pure[var->index] || static_cast<Lambda*>(letrec->bind[var->index].second.get())->x.size() != node->rand.size())
+                return false;
+            calls++;
+            tail_self = tail_self || (tail && var->index == self);
+            for (const Expr& rand : node->rand)
+                if (!scan(rand.get(), depth, false, self))
+                    return false;
+            return true;
+        }
+        case E_IF: {
+            If* node = static_cast<If*>(e);
+            return scan(node->cond.get(), depth, false, self) && scan(node->conseq.get(), depth, tail, self) && scan(node->alter.get(), depth, tail, self);
+        }
+        case E_LET: {
+            Let* node = static_cast<Let*>(e);
+            for (const auto& b : node->bind)
+                if (!scan(b.second.get(), depth, false, self))
+                    return false;
+            return scan(node->body.get(), depth + 1, tail, self);
+        }
+        case E_LETREC: {
+            Letrec* node = static_cast<Letrec*>(e);
+            for (const auto& b : node->bind)
+                if (!scan(b.second.get(), depth + 1, false, self))
+                    return false;
+            return scan(node->body.get(), depth + 1, tail, self);
+        }
+        case E_BEGIN: {
+            const std::vector<Expr>& es = static_cast<Begin*>(e)->es;
+            for (int i = 0; i < es.size(); i++)
+                if (!scan(es[i].get(), depth, tail && i + 1 == es.size(), self))
+                    return false;
+            return true;
+        }
+        default: {
+            bool only = true;
+            forEachChild(e, [&](ExprBase* child, int levels) { only = only && scan(child, depth + levels, false, self); });
+            return only;
+        }
+        }
+    }
+};
+
+/* the bindings of a letrec that --auto-memo memoizes: the pure lambdas are found by
+ * dropping the impure ones until none is left, then the tree recursive ones kept */
+static std::vector<bool> memoized(Letrec* node)
+{
+    int n = node->bind.size();
+    Memoizer memoizer { node, std::vector<bool>(n, false) };
+    for (int i = 0; i < n; i++)
+        memoizer.pure[i] = node->bind[i].second->e_type == E_LAMBDA;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = 0; i < n; i++)
+            if (memoizer.pure[i] && !memoizer.scan(static_cast<Lambda*>(node->bind[i].second.get())->e.get(), 1, true, i)) {
+                memoizer.pure[i] = false;
+                changed = true;
+            }
+    }
+    std::vector<bool> memo(n, false);
+    for (int i = 0; i < n; i++) {
+        if (!memoizer.pure[i])
+            continue;
+        memoizer.calls = 0;
+        memoizer.tail_self = false;
+        memoizer.scan(static_cast<Lambda*>(node->bind[i].second.get())->e.get(), 1, true, i);
+        memo[i] = memoizer.calls >= 2 && !memoizer.tail_self;
+    }
+    return memo;
+}
+
+/* what became of the slots of a frame around the node being rewritten */
+struct FrameInfo {
+    bool dropped = false; // no slot is left, nor the frame
+    bool recursive = false; // a letrec frame
+    std::vector<int> index; // the new slot, -1 if removed
+    std::vector<Expr> value; // the constant or variable a removed slot was bound to
+    std::vector<int> arity; // of the lambda bound to the slot, -1 if it is not one
+    std::vector<Lambda*> inline_lambda; // the lambda bound to the slot, if calls inline it
+    bool initializing = false; // a letrec frame whose bindings are being evaluated
+    bool flat = false; // the frame of the parameters of a flat lambda
+    std::vector<Var*> captured; // the variables it reads outside, from the env it is made in
+
+    /* the slot of the closure's frame holding the variable depth levels up from the env
+     * the lambda is made in */
+    int capture(Symbol* x, int depth, int index)
+    {
+        for (int i = 0; i < captured.size(); i++)
+            if (captured[i]->depth == depth && captured[i]->index == index)
+                return i;
+        captured.push_back(make<Var>(x, depth, index));
+        return captured.size() - 1;
+    }
+};
+
+struct Optimizer {
+    std::vector<FrameInfo> frames; // innermost last
+
+    int inlined = 0; // calls inlined by this pass
+    bool flatten = false; // make flat lambdas, the pass must then be the last one
+
+    /* a frame whose slots are all kept */
+    void enter(int n, bool recursive)
+    {
+        FrameInfo frame;
+        frame.recursive = recursive;
+        for (int i = 0; i < n; i++)
+            frame.index.push_back(i);
+        frame.value.resize(n, Expr(nullptr));
+        frame.arity.resize(n, -1);
+        frame.inline_lambda.resize(n, nullptr);
+        frames.push_back(frame);
+    }
+
+    Expr expr(const Expr&);
+    Expr var(Var*);
+    Expr lambda(Lambda*, bool);
+    Expr apply(Apply*);
+    Expr inlineCall(Lambda*, const std::vector<Expr>&, int);
+    Expr let(Let*);
+    Expr fold(const Expr&);
+
+    /* e is a variable whose uses can read the variable it is bound to instead: one
+     * bound outside letrec frames, which are read before they are assigned */
+    bool isCopy(const Expr& e)
+    {
+        if (e->e_type != E_VAR)
+            return false;
+        Var* var = static_cast<Var*>(e.get());
+        return var->depth >= 0 && var->depth < frames.size() && !frames[frames.size() - 1 - var->depth].recursive;
+    }
+};
+
+/* evaluate a primitive on constants now, unless it fails or its value is no constant */
+Expr Optimizer::fold(const Expr& e)
+{
+    try {
+        Expr c = constant(e->eval(empty()));
+        if (c.get() != nullptr)
+            return c;
+    } catch (const RuntimeError&) {
+    }
+    return e;
+}
+
+Expr Optimizer::var(Var* v)
+{
+    if (v->depth < 0)
+        return Expr(v);
+
+    int n = frames.size();
+    if (v->depth < n && frames[n - 1 - v->depth].index[v->index] < 0) {
+        const Expr& value = frames[n - 1 - v->depth].value[v->index];
+        if (value->e_type != E_VAR)
+            return constant(value->eval(empty()));
+
+        /* a copy of a variable of the env around the let frame */
+        Var* copy = static_cast<Var*>(value.get());
+        Var moved(copy->x, copy->depth + v->depth + 1, copy->index);
+        return var(&moved);
+    }
+
+    /* frames the variable crosses that were dropped no longer count, the first flat
+     * lambda it crosses reads it from the frame of its closure, next to its parameters */
+    int depth = 0;
+    for (int i = 0; i < v->depth && i < n; i++) {
+        FrameInfo& frame = frames[n - 1 - i];
+        if (frame.flat)
+            return Expr(make<Var>(v->x, depth + 1, frame.capture(v->x, v->depth - i - 1, v->index)));
+        if (!frame.dropped)
+            depth++;
+    }
+    if (v->depth >= n)
+        return Expr(make<Var>(v->x, depth + v->depth - n, v->index));
+    return Expr(make<Var>(v->x, depth, frames[n - 1 - v->depth].index[v->index]));
+}
+
+/* with flatten, a lambda's closures capture the variables it reads. one made while a
+ * letrec binding is evaluated keeps the env if it reads that letrec, its slots are not
+ * assigned yet; only the closures bound by the letrec itself are given them then */
+Expr Optimizer::lambda(Lambda* node, bool bound)
+{
+    bool flat = flatten;
+    for (int i = 0; i < frames.size() && flat; i++)
+        if (frames[frames.size() - 1 - i].initializing && !(bound && i == 0) && refersTo(node->e.get(), i + 1))
+            flat = false;
+
+    enter(node->x.size(), false);
+    frames.back().flat = flat;
+    Expr body = expr(node->e);
+    std::vector<Var*> captured = std::move(frames.back().captured);
+    frames.pop_back();
+
+    Lambda* result = make<Lambda>(node->x, body, node->form);
+    result->flat = flat;
+    for (Var* v : captured) {
+        Expr slot = var(v);
+        result->captured.push_back(std::make_pair(static_cast<Var*>(slot.get())->depth, static_cast<Var*>(slot.get())->index));
+    }
+    return Expr(result);
+}
+
+Expr Optimizer::let(Let* node)
+{
+    std::vector<Expr> values;
+    for (const auto& b : node->bind)
+        values.push_back(expr(b.second));
+
+    /* the uses are counted before the body is rewritten, a use in an arm that is then
+     * removed still keeps its binding */
+    std::vector<int> uses(node->bind.size(), 0);
+    countUses(node->body.get(), 0, uses);
+
+    FrameInfo frame;
+    std::vector<std::pair<Symbol*, Expr>> bind;
+    for (int i = 0; i < values.size(); i++) {
+        if (isConstant(values[i]) || isCopy(node->bind[i].second)) {
+            frame.index.push_back(-1);
+            frame.value.push_back(isConstant(values[i]) ? values[i] : node->bind[i].second);
+        } else if (uses[i] == 0 && isPure(values[i])) {
+            frame.index.push_back(-1);
+            frame.value.push_back(Expr(nullptr));
+        } else {
+            frame.index.push_back(bind.size());
+            frame.value.push_back(Expr(nullptr));
+            bind.push_back(std::make_pair(node->bind[i].first, values[i]));
+        }
+        frame.arity.push_back(values[i]->e_type == E_LAMBDA ? (int)static_cast<Lambda*>(values[i].get())->x.size() : -1);
+        const Expr& value = node->bind[i].second;
+        bool small = value->e_type == E_LAMBDA && size(static_cast<Lambda*>(value.get())->e.get()) <= inline_budget;
+        frame.inline_lambda.push_back(small ? static_cast<Lambda*>(value.get()) : nullptr);
+    }
+    frame.dropped = bind.empty();
+
+    frames.push_back(frame);
+    Expr body = expr(node->body);
+    frames.pop_back();
+    if (bind.empty())
+        return body;
+    return Expr(make<Let>(bind, body));
+}
+
+/* a call of a lambda, or of a variable bound to a small one, with the right arity is
+ * inlined as a let of the arguments; a call of a variable bound to a lambda of the
+ * right arity is a known call, one of a primitive is its node */
+Expr Optimizer::apply(Apply* node)
+{
+    if (node->rator->e_type == E_LAMBDA) {
+        Lambda* lambda = static_cast<Lambda*>(node->rator.get());
+        if (lambda->x.size() == node->rand.size())
+            return inlineCall(lambda, node->rand, 0);
+    }
+
+    Var* var = node->rator->e_type == E_VAR ? static_cast<Var*>(node->rator.get()) : nullptr;
+    if (var != nullptr && var->depth >= 0 && var->depth < frames.size()) {
+        const FrameInfo& frame = frames[frames.size() - 1 - var->depth];
+        Lambda* lambda = frame.inline_lambda[var->index];
+        if (lambda != nullptr && lambda->x.size() == node->rand.size()) {
+            /* the frames from the call up to the closure's env: a let-bound closure was
+             * made outside the let frame, a letrec-bound one in it */
+            inlined++;
+            return inlineCall(lambda, node->rand, frame.recursive ? var->depth : var->depth + 1);
+        }
+    }
+
+    Expr rator = expr(node->rator);
+    std::vector<Expr> rand;
+    for (const Expr& r : node->rand)
+        rand.push_back(expr(r));
+
+    if (rator->e_type == E_GETTYPE) {
+        const Primitive* primitive = primitiveOf(static_cast<GetType*>(rator.get())->op);
+        if (primitive != nullptr && rand.size() >= primitive->min_args && rand.size() <= primitive->max_args)
+            return makePrimitive(primitive->op, rand);
+    }
+    if (var != nullptr && var->depth >= 0 && var->depth < frames.size() && rator->e_type == E_VAR) {
+        const FrameInfo& frame = frames[frames.size() - 1 - var->depth];
+        if (frame.arity[var->index] == rand.size())
+            return Expr(make<KnownCall>(rator, rand, frame.recursive));
+    }
+    return Expr(make<Apply>(rator, rand));
+}
+
+/* (let ((x rand) ...) body) for the body of lambda, made k frames above the call */
+Expr Optimizer::inlineCall(Lambda* lambda, const std::vector<Expr>& rand, int k)
+{
+    std::vector<std::pair<Symbol*, Expr>> bind;
+    for (int i = 0; i < rand.size(); i++)
+        bind.push_back(std::make_pair(lambda->x[i], rand[i]));
+    return let(make<Let>(bind, shift(lambda->e, 1, k)));
+}
+
+Expr Optimizer::expr(const Expr& e)
+{
+    switch (e->e_type) {
+    case E_VAR:
+        return var(static_cast<Var*>(e.get()));
+
+    case E_LET:
+        return let(static_cast<Let*>(e.get()));
+
+    case E_LETREC: {
+        Letrec* node = static_cast<Letrec*>(e.get());
+        if (auto_memo) {
+            std::vector<bool> memo = memoized(node);
+            if (std::count(memo.begin(), memo.end(), true) > 0) {
+                std::vector<std::pair<Symbol*, Expr>> bind = node->bind;
+                for (int i = 0; i < bind.size(); i++)
+                    if (memo[i])
+                        bind[i].second = makeUnary(E_MEMO, bind[i].second);
+                node = make<Letrec>(bind, node->body);
+            }
+        }
+        enter(node->bind.size(), true);
+        bool lambdas = true;
+        for (int i = 0; i < node->bind.size(); i++) {
+            const Expr& value = node->bind[i].second;
+            if (value->e_type == E_LAMBDA)
+                frames.back().arity[i] = static_cast<Lambda*>(value.get())->x.size();
+            else
+                lambdas = false;
+        }
+
+        /* when the bindings are all lambdas no code runs before the slots are assigned,
+         * so a call can inline the small ones that do not refer to the frame */
+        for (int i = 0; i < node->bind.size() && lambdas; i++) {
+            Lambda* lambda = static_cast<Lambda*>(node->bind[i].second.get());
+            std::vector<int> uses(node->bind.size(), 0);
+            countUses(lambda->e.get(), 1, uses);
+            if (size(lambda->e.get()) <= inline_budget && std::count(uses.begin(), uses.end(), 0) == uses.size())
+                frames.back().inline_lambda[i] = lambda;
+        }
+        frames.back().initializing = true;
+        std::vector<std::pair<Symbol*, Expr>> bind;
+        for (const auto& b : node->bind) {
+            if (b.second->e_type == E_LAMBDA)
+                bind.push_back(std::make_pair(b.first, lambda(static_cast<Lambda*>(b.second.get()), true)));
+            else
+                bind.push_back(std::make_pair(b.first, expr(b.second)));
+        }
+        frames.back().initializing = false;
+        Expr body = expr(node->body);
+        frames.pop_back();
+        return Expr(make<Letrec>(bind, body));
+    }
+
+    case E_LAMBDA:
+        return lambda(static_cast<Lambda*>(e.get()), false);
+
+    case E_APPLY:
+        return apply(static_cast<Apply*>(e.get()));
+
+    /* only the arm a constant condition takes is kept */
+    case E_IF: {
+        If* node = static_cast<If*>(e.get());
+        Expr cond = expr(node->cond);
+        if (isConstant(cond))
+            return expr(cond->e_type == E_FALSE ? node->alter : node->conseq);
+        return Expr(make<If>(cond, expr(node->conseq), expr(node->alter)));
+    }
+
+    /* pure expressions whose value is dropped are removed */
+    case E_BEGIN: {
+        Begin* node = static_cast<Begin*>(e.get());
+        std::vector<Expr> es;
+        for (int i = 0; i < node->es.size(); i++) {
+            Expr ei = expr(node->es[i]);
+            if (i + 1 == node->es.size() || !isPure(ei))
+                es.push_back(ei);
+        }
+        if (es.size() == 1)
+            return es[0];
+        return Expr(make<Begin>(es));
+    }
+
+    default:
+        break;
+    }
+
+    if (isBinary(e->e_type)) {
+        Binary* node = static_cast<Binary*>(e.get());
+        Expr rand1 = expr(node->rand1), rand2 = expr(node->rand2);
+        Expr result = node->fixnums ? makeFixnumBinary(e->e_type, rand1, rand2) : makeBinary(e->e_type, rand1, rand2);
+        if (isConstant(rand1) && isConstant(rand2))
+            return fold(result);
+        return result;
+    }
+    if (isUnary(e->e_type) || e->e_type == E_CALLCC) {
+        Unary* node = static_cast<Unary*>(e.get());
+        Expr rand = expr(node->rand);
+        Expr result = makeUnary(e->e_type, rand);
+        if (isConstant(rand) && e->e_type != E_CALLCC)
+            return fold(result);
+        return result;
+    }
+
+    /* the other leaves: quote, (void), (exit), a bare primitive name */
+    return e;
+}
+
+/* lambda lifting: a lambda bound by let, or by a letrec of lambdas, whose variable is
+ * only ever the operator of calls with its arity does not need a closure. it is moved
+ * to a letrec put around the whole form, with the variables it reads from the frames
+ * around it as extra parameters, and its calls pass them. the closures of the form's
+ * lifted lambdas are then made once per evaluation of the form, instead of once per
+ * evaluation of their let or letrec */
+
+/* a variable of a frame around a lifted lambda */
+struct FreeVar {
+    int level; // of its frame, counted from the outermost frame of the form
+    int index;
+    Symbol* x;
+    bool operator==(const FreeVar& other) const
+    {
+        return level == other.level && index == other.index;
+    }
+};
+
+struct Lifted {
+    Lambda* lambda;
+    Symbol* name;
+    int level; // of the frame of its parameters
+    int slot; // in the frame around the form
+    std::vector<FreeVar> free; // the extra parameters, after its own
+    std::vector<Lifted*> callees; // lifted lambdas its body calls
+};
+
+/* e refers to slot index of the frame depth levels up only as the operator of calls
+ * with arity arguments */
+static bool onlyCalled(ExprBase* e, int depth, int index, int arity)
+{
+    auto refers = [&](ExprBase* x) {
+        return x->e_type == E_VAR && static_cast<Var*>(x)->depth == depth && static_cast<Var*>(x)->index == index;
+    };
+    if (refers(e))
+        return false;
+    if (e->e_type == E_APPLY) {
+        Apply* apply = static_cast<Apply*>(e);
+        if (refers(apply->rator.get()) ? apply->rand.size() != arity : !onlyCalled(apply->rator.get(), depth, index, arity))
+            return false;
+        for (const Expr& rand : apply->rand)
+            if (!onlyCalled(rand.get(), depth, index, arity))
+                return false;
+        return true;
+    }
+    bool only = true;
+    forEachChild(e, [&](ExprBase* child, int levels) { only = only && onlyCalled(child, depth + levels, index, arity); });
+    return only;
+}
+
+/* where an original frame is in the rewritten form */
+struct LiftFrame {
+    int level; // the original frame, -1 for the frame of the lifted lambdas
+    Lifted* lifted; // the frame of this lifted lambda, standing for every frame around it
+    std::vector<int> index; // the new slots of the original frame
+};
+
+struct Lifter {
+    std::map<std::pair<ExprBase*, int>, Lifted*> lifted; // by binding node and slot
+    std::vector<Lifted*> order;
+    std::vector<ExprBase*> path; // the nodes making the frames around, outermost first
+    std::vector<Lifted*> inside; // the lifted lambdas around
+    std::vector<LiftFrame> chain; // the frames around in the rewritten form
+    std::vector<std::pair<Symbol*, Expr>> top; // the letrec of the lifted lambdas
+
+    ~Lifter()
+    {
+        for (Lifted* l : order)
+            delete l;
+    }
+
+    Lifted* liftedAt(ExprBase* node, int index)
+    {
+        auto it = lifted.find(std::make_pair(node, index));
+        return it == lifted.end() ? nullptr : it->second;
+    }
+    Lifted* candidate(ExprBase* node, int index, const Expr& value, Symbol* name, int level)
+    {
+        Lambda* lambda = static_cast<Lambda*>(value.get());
+        Lifted* l = new Lifted { lambda, name, level, (int)order.size(), {}, {} };
+        lifted[std::make_pair(node, index)] = l;
+        order.push_back(l);
+        return l;
+    }
+
+    void collect(ExprBase*);
+    void collectLifted(Lifted*);
+    Expr rewrite(const Expr&);
+    Expr rewriteLifted(Lifted*);
+    Expr var(const FreeVar&);
+};
+
+void Lifter::collectLifted(Lifted* l)
+{
+    path.push_back(l->lambda);
+    inside.push_back(l);
+    collect(l->lambda->e.get());
+    inside.pop_back();
+    path.pop_back();
+}
+
+/* find the lambdas to lift, with the variables and the lifted lambdas they use */
+void Lifter::collect(ExprBase* e)
+{
+    switch (e->e_type) {
+    case E_VAR: {
+        Var* v = static_cast<Var*>(e);
+        if (v->depth < 0)
+            return;
+        int level = (int)path.size() - 1 - v->depth;
+        Lifted* callee = liftedAt(path[level], v->index);
+        for (Lifted* l : inside) {
+            if (callee != nullptr)
+                l->callees.push_back(callee);
+            else if (level < l->level && std::find(l->free.begin(), l->free.end(), FreeVar { level, v->index, v->x }) == l->free.end())
+                l->free.push_back(FreeVar { level, v->index, v->x });
+        }
+        return;
+    }
+
+    case E_LET: {
+        Let* node = static_cast<Let*>(e);
+        for (int i = 0; i < node->bind.size(); i++) {
+            const Expr& value = node->bind[i].second;
+            if (value->e_type == E_LAMBDA && onlyCalled(node->body.get(), 0, i, static_cast<Lambda*>(value.get())->x.size()))
+                collectLifted(candidate(node, i, value, node->bind[i].first, path.size()));
+            else
+                collect(value.get());
+        }
+        path.push_back(node);
+        collect(node->body.get());
+        path.pop_back();
+        return;
+    }
+
+    case E_LETREC: {
+        Letrec* node = static_cast<Letrec*>(e);
+        bool lambdas = true;
+        for (const auto& b : node->bind)
+            lambdas = lambdas && b.second->e_type == E_LAMBDA;
+
+        /* with lambdas only no call is made before the slots are assigned, so the slots
+         * the lifted lambdas read are assigned when they are passed */
+        for (int i = 0; i < node->bind.size() && lambdas; i++) {
+            int arity = static_cast<Lambda*>(node->bind[i].second.get())->x.size();
+            bool only = onlyCalled(node->body.get(), 0, i, arity);
+            for (const auto& b : node->bind)
+                only = only && onlyCalled(b.second.get(), 0, i, arity);
+            if (only)
+                candidate(node, i, node->bind[i].second, node->bind[i].first, path.size() + 1);
+        }
+        path.push_back(node);
+        for (int i = 0; i < node->bind.size(); i++) {
+            Lifted* l = liftedAt(node, i);
+            if (l != nullptr)
+                collectLifted(l);
+            else
+                collect(node->bind[i].second.get());
+        }
+        collect(node->body.get());
+        path.pop_back();
+        return;
+    }
+
+    case E_LAMBDA:
+        path.push_back(e);
+        collect(static_cast<Lambda*>(e)->e.get());
+        path.pop_back();
+        return;
+
+    default:
+        forEachChild(e, [&](ExprBase* child, int) { collect(child); });
+        return;
+    }
+}
+
+/* the variable in the rewritten form */
+Expr Lifter::var(const FreeVar& v)
+{
+    for (int i = (int)chain.size() - 1, depth = 0; i >= 0; i--, depth++) {
+        const LiftFrame& frame = chain[i];
+        if (frame.lifted != nullptr) {
+            Lifted* l = frame.lifted;
+            if (v.level == l->level)
+                return Expr(make<Var>(v.x, depth, v.index));
+            int j = std::find(l->free.begin(), l->free.end(), v) - l->free.begin();
+            return Expr(make<Var>(v.x, depth, (int)l->lambda->x.size() + j));
+        }
+        if (frame.level == v.level)
+            return Expr(make<Var>(v.x, depth, frame.index[v.index]));
+    }
+    return Expr(nullptr);
+}
+
+/* the body of l in the frame of its parameters and free variables, in the letrec */
+Expr Lifter::rewriteLifted(Lifted* l)
+{
+    std::vector<LiftFrame> saved = std::move(chain);
+    chain = { saved[0], LiftFrame { l->level, l, {} } };
+    path.push_back(l->lambda);
+    Expr body = rewrite(l->lambda->e);
+    path.pop_back();
+    chain = std::move(saved);
+
+    std::vector<Symbol*> x = l->lambda->x;
+    for (const FreeVar& v : l->free)
+        x.push_back(v.x);
+    top[l->slot] = std::make_pair(l->name, Expr(make<Lambda>(x, body, l->lambda->form)));
+    return body;
+}
+
+Expr Lifter::rewrite(const Expr& e)
+{
+    switch (e->e_type) {
+    case E_VAR: {
+        Var* v = static_cast<Var*>(e.get());
+        if (v->depth < 0)
+            return e;
+        return var(FreeVar { (int)path.size() - 1 - v->depth, v->index, v->x });
+    }
+
+    case E_LET: {
+        Let* node = static_cast<Let*>(e.get());
+        LiftFrame frame { (int)path.size(), nullptr, {} };
+        std::vector<std::pair<Symbol*, Expr>> bind;
+        for (int i = 0; i < node->bind.size(); i++) {
+            Lifted* l = liftedAt(node, i);
+            frame.index.push_back(l != nullptr ? -1 : (int)bind.size());
+            if (l != nullptr)
+                rewriteLifted(l);
+            else
+                bind.push_back(std::make_pair(node->bind[i].first, rewrite(node->bind[i].second)));
+        }
+        path.push_back(node);
+        if (!bind.empty())
+            chain.push_back(frame);
+        Expr body = rewrite(node->body);
+        if (!bind.empty())
+            chain.pop_back();
+        path.pop_back();
+        if (bind.empty())
+            return body;
+        return Expr(make<Let>(bind, body));
+    }
+
+    case E_LETREC: {
+        Letrec* node = static_cast<Letrec*>(e.get());
+        LiftFrame frame { (int)path.size(), nullptr, {} };
+        int kept = 0;
+        for (int i = 0; i < node->bind.size(); i++)
+            frame.index.push_back(liftedAt(node, i) != nullptr ? -1 : kept++);
+        path.push_back(node);
+        if (kept > 0)
+            chain.push_back(frame);
+        std::vector<std::pair<Symbol*, Expr>> bind;
+        for (int i = 0; i < node->bind.size(); i++) {
+            Lifted* l = liftedAt(node, i);
+            if (l != nullptr)
+                rewriteLifted(l);
+            else
+                bind.push_back(std::make_pair(node->bind[i].first, rewrite(node->bind[i].second)));
+        }
+        Expr body = rewrite(node->body);
+        if (kept > 0)
+            chain.pop_back();
+        path.pop_back();
+        if (bind.empty())
+            return body;
+        return Expr(make<Letrec>(bind, body));
+    }
+
+    case E_LAMBDA: {
+        Lambda* node = static_cast<Lambda*>(e.get());
+        LiftFrame frame { (int)path.size(), nullptr, {} };
+        for (int i = 0; i < node->x.size(); i++)
+            frame.index.push_back(i);
+        path.push_back(node);
+        chain.push_back(frame);
+        Expr body = rewrite(node->e);
+        chain.pop_back();
+        path.pop_back();
+        return Expr(make<Lambda>(node->x, body, node->form));
+    }
+
+    /* a call of a lifted lambda passes its free variables after the arguments */
+    case E_APPLY: {
+        Apply* node = static_cast<Apply*>(e.get());
+        std::vector<Expr> rand;
+        for (const Expr& r : node->rand)
+            rand.push_back(rewrite(r));
+        Var* v = node->rator->e_type == E_VAR ? static_cast<Var*>(node->rator.get()) : nullptr;
+        Lifted* l = v != nullptr && v->depth >= 0 ? liftedAt(path[path.size() - 1 - v->depth], v->index) : nullptr;
+        if (l == nullptr)
+            return Expr(make<Apply>(rewrite(node->rator), rand));
+        for (const FreeVar& fv : l->free)
+            rand.push_back(var(fv));
+        return Expr(make<Apply>(Expr(make<Var>(l->name, (int)chain.size() - 1, l->slot)), rand));
+    }
+
+    case E_IF: {
+        If* node = static_cast<If*>(e.get());
+        return Expr(make<If>(rewrite(node->cond), rewrite(node->conseq), rewrite(node->alter)));
+    }
+
+    case E_BEGIN: {
+        std::vector<Expr> es;
+        for (const Expr& ei : static_cast<Begin*>(e.get())->es)
+            es.push_back(rewrite(ei));
+        return Expr(make<Begin>(es));
+    }
+
+    default:
+        break;
+    }
+    if (isBinary(e->e_type)) {
+        Binary* node = static_cast<Binary*>(e.get());
+        return makeBinary(e->e_type, rewrite(node->rand1), rewrite(node->rand2));
+    }
+    if (isUnary(e->e_type) || e->e_type == E_CALLCC)
+        return makeUnary(e->e_type, rewrite(static_cast<Unary*>(e.get())->rand));
+    return e;
+}
+
+/* the form with its lambdas lifted, e itself if there are none */
+static Expr lift(const Expr& e)
+{
+    Lifter lifter;
+    lifter.collect(e.get());
+    if (lifter.order.empty())
+        return e;
+
+    /* the free variables of a callee that are outside the caller are the caller's too */
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (Lifted* l : lifter.order)
+            for (Lifted* callee : l->callees)
+                for (const FreeVar& v : callee->free)
+                    if (v.level < l->level && std::find(l->free.begin(), l->free.end(), v) == l->free.end()) {
+                        l->free.push_back(v);
+                        changed = true;
+                    }
+    }
+
+    lifter.top.resize(lifter.order.size(), std::make_pair(nullptr, Expr(nullptr)));
+    lifter.chain.push_back(LiftFrame { -1, nullptr, {} });
+    Expr body = lifter.rewrite(e);
+    return Expr(make<Letrec>(lifter.top, body));
+}
+
+/* type inference: an expression is a fixnum if, whenever it returns, its value is one.
+ * so are fixnum literals and the values of +, - and * (they raise an error otherwise),
+ * an if whose arms both are, the body of let, letrec and begin, a variable bound by let
+ * to one, and a call of a lambda whose body is one. the parameters of a lambda bound
+ * by let or letrec and only ever called are fixnums if all its calls pass them. the
+ * facts about lambdas start out true and are made false until none changes, then the
+ * arithmetic and comparisons whose operands both are fixnums are marked */
+struct Signature {
+    std::vector<bool> params;
+    bool result;
+};
+
+struct Typer {
+    struct Slot {
+        bool fixnum;
+        Lambda* lambda; // bound to the slot and only called, nullptr if there is none
+    };
+    std::vector<std::vector<Slot>> frames; // innermost last
+    std::map<Lambda*, Signature> known; // the only called lambdas
+    bool changed = false; // a fact about a lambda was made false, or a lambda found
+    bool mark = false; // the facts are final, mark the nodes
+
+    bool expr(ExprBase*);
+    void lambda(Lambda*);
+
+    /* a lambda whose variable body only calls, with its arity */
+    void found(Lambda* lambda)
+    {
+        if (known.find(lambda) == known.end()) {
+            known[lambda] = Signature { std::vector<bool>(lambda->x.size(), true), true };
+            changed = true;
+        }
+    }
+    const Slot* slot(ExprBase* e)
+    {
+        if (e->e_type != E_VAR)
+            return nullptr;
+        Var* var = static_cast<Var*>(e);
+        if (var->depth < 0 || var->depth >= frames.size())
+            return nullptr;
+        return &frames[frames.size() - 1 - var->depth][var->index];
+    }
+};
+
+void Typer::lambda(Lambda* node)
+{
+    auto it = known.find(node);
+    std::vector<Slot> params;
+    for (int i = 0; i < node->x.size(); i++)
+        params.push_back(Slot { it != known.end() && it->second.params[i], nullptr });
+    frames.push_back(params);
+    bool result = expr(node->e.get());
+    frames.pop_back();
+    if (it != known.end() && it->second.result && !result) {
+        it->second.result = false;
+        changed = true;
+    }
+}
+
+bool Typer::expr(ExprBase* e)
+{
+    switch (e->e_type) {
+    case E_FIXNUM:
+        return true;
+
+    case E_VAR: {
+        const Slot* s = slot(e);
+        return s != nullptr && s->fixnum;
+    }
+
+    case E_LET: {
+        Let* node = static_cast<Let*>(e);
+        std::vector<Slot> frame;
+        for (int i = 0; i < node->bind.size(); i++) {
+            ExprBase* value = node->bind[i].second.get();
+            Lambda* lambda = nullptr;
+            if (value->e_type == E_LAMBDA && onlyCalled(node->body.get(), 0, i, static_cast<Lambda*>(value)->x.size())) {
+                lambda = static_cast<Lambda*>(value);
+                found(lambda);
+            }
+            frame.push_back(Slot { expr(value), lambda });
+        }
+        frames.push_back(frame);
+        bool result = expr(node->body.get());
+        frames.pop_back();
+        return result;
+    }
+
+    /* a slot is only read once it is assigned, but it may be read by a binding before
+     * its own is: only the lambdas are followed */
+    case E_LETREC: {
+        Letrec* node = static_cast<Letrec*>(e);
+        std::vector<Slot> frame;
+        for (int i = 0; i < node->bind.size(); i++) {
+            ExprBase* value = node->bind[i].second.get();
+            bool only = value->e_type == E_LAMBDA && onlyCalled(node->body.get(), 0, i, static_cast<Lambda*>(value)->x.size());
+            for (int j = 0; j < node->bind.size() && only; j++)
+                only = onlyCalled(node->bind[j].second.get(), 0, i, static_cast<Lambda*>(value)->x.size());
+            frame.push_back(Slot { false, only ? static_cast<Lambda*>(value) : nullptr });
+            if (only)
+                found(static_cast<Lambda*>(value));
+        }
+        frames.push_back(frame);
+        for (const auto& b : node->bind)
+            expr(b.second.get());
+        bool result = expr(node->body.get());
+        frames.pop_back();
+        return result;
+    }
+
+    case E_LAMBDA:
+        lambda(static_cast<Lambda*>(e));
+        return false;
+
+    case E_APPLY: {
+        Apply* node = static_cast<Apply*>(e);
+        expr(node->rator.get());
+        std::vector<bool> rand;
+        for (const Expr& r : node->rand)
+            rand.push_back(expr(r.get()));
+        const Slot* s = slot(node->rator.get());
+        if (s == nullptr || s->lambda == nullptr)
+            return false;
+        Signature& signature = known[s->lambda];
+        for (int i = 0; i < rand.size(); i++)
+            if (signature.params[i] && !rand[i]) {
+                signature.params[i] = false;
+                changed = true;
+            }
+        return signature.result;
+    }
+
+    case E_IF: {
+        If* node = static_cast<If*>(e);
+        expr(node->cond.get());
+        bool conseq = expr(node->conseq.get());
+        bool alter = expr(node->alter.get());
+        return conseq && alter;
+    }
+
+    case E_BEGIN: {
+        bool result = false;
+        for (const Expr& ei : static_cast<Begin*>(e)->es)
+            result = expr(ei.get());
+        return result;
+    }
+
+    default:
+        break;
+    }
+
+    if (isBinary(e->e_type)) {
+        Binary* node = static_cast<Binary*>(e);
+        bool rand1 = expr(node->rand1.get());
+        bool rand2 = expr(node->rand2.get());
+        if (mark && rand1 && rand2 && e->e_type != E_EQQ && e->e_type != E_CONS)
+            node->fixnums = true;
+        return e->e_type == E_MUL || e->e_type == E_PLUS || e->e_type == E_MINUS;
+    }
+    forEachChild(e, [&](ExprBase* child, int) { expr(child); });
+    return false;
+}
+
+/* mark the nodes of e the final facts prove to be on fixnums, see Typer */
+static void inferTypes(const Expr& e)
+{
+    Typer typer;
+    do {
+        typer.changed = false;
+        typer.expr(e.get());
+    } while (typer.changed);
+    typer.mark = true;
+    typer.expr(e.get());
+}
+
+int inline_budget = 16;
+
+/* a pass that inlined calls is followed by another one, which removes the bindings no
+ * call uses any more and inlines the calls the inlined bodies brought; the number of
+ * passes bounds the growth of mutually calling lambdas. the lambdas left are lifted,
+ * their types inferred, and a last pass makes known calls of the calls of the lifted
+ * lambdas, unchecked arithmetic of that on fixnums and flat closures of all of them */
+Expr optimize(const Expr& e)
+{
+    Expr result = e;
+    for (int pass = 0; pass < 3; pass++) {
+        Optimizer optimizer;
+        result = optimizer.expr(result);
+        if (optimizer.inlined == 0)
+            break;
+    }
+    result = lift(result);
+    inferTypes(result);
+    Optimizer optimizer;
+    optimizer.flatten = true;
+    return optimizer.expr(result);
+}
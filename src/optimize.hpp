@@ -0,0 +1,29 @@
+#ifndef OPTIMIZE
+#define OPTIMIZE
+
+#include "Def.hpp"
+#include "expr.hpp"
+
+/* rewrite a parsed form before it runs: calls are inlined (see inline_budget),
+ * primitives applied to constants are folded, let-bound constants and variables are
+ * propagated into their uses, if with a constant condition keeps only the arm it
+ * takes, and let bindings that are pure and unused are removed (with their frame once
+ * it is empty). lambdas are then made flat: their closures keep a frame of the slots
+ * the body reads instead of the whole env, see Lambda::captured.
+ * a fold that would raise an error is left in place, so the error is still raised
+ * when the form runs. the new nodes are allocated in ExprArena::current */
+Expr optimize(const Expr&);
+
+/* lambdas bound by let, or by a letrec of lambdas without referring to it, are inlined
+ * at their calls when their body has at most inline_budget nodes; a lambda applied
+ * where it is written is always inlined. --inline-budget=N sets it, 0 only keeps the
+ * latter */
+extern int inline_budget;
+
+/* --auto-memo: a lambda bound by letrec is memoized (see Memo) when it is pure and
+ * tree recursive: its body only calls lambdas of the same letrec that are pure too,
+ * twice or more and never itself in tail position, and makes no closure, pair or
+ * continuation, nor leaves */
+extern bool auto_memo;
+
+#endif
@@ -0,0 +1,74 @@
+#include "pool.hpp"
+#include <new>
+
+#ifndef SYSTEM_ALLOCATOR
+
+struct FreeNode {
+    FreeNode* next;
+};
+
+struct PoolCache {
+    FreeNode* free[POOL_MAX_SIZE / POOL_GRAIN];
+};
+
+/* slabs are never handed back, objects freed by another thread simply join its lists */
+static thread_local PoolCache cache;
+
+static size_t size_class(size_t size)
+{
+    return (size + POOL_GRAIN - 1) / POOL_GRAIN - 1;
+}
+
+/* carve a new slab into objects of class c */
+static FreeNode* refill(size_t c)
+{
+    size_t size = (c + 1) * POOL_GRAIN;
+    char* slab = static_cast<char*>(::operator new(POOL_SLAB_SIZE));
+    FreeNode* head = nullptr;
+    for (size_t off = POOL_SLAB_SIZE / size * size; off >= size; off -= size) {
+        FreeNode* node = reinterpret_cast<FreeNode*>(slab + off - size);
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+void* pool_alloc(size_t size)
+{
+    if (size == 0 || size > POOL_MAX_SIZE)
+        return ::operator new(size);
+    size_t c = size_class(size);
+    FreeNode* node = cache.free[c];
+    if (node == nullptr)
+        node = refill(c);
+    cache.free[c] = node->next;
+    return node;
+}
+
+void pool_free(void* p, size_t size)
+{
+    if (p == nullptr)
+        return;
+    if (size == 0 || size > POOL_MAX_SIZE) {
+        ::operator delete(p);
+        return;
+    }
+    size_t c = size_class(size);
+    FreeNode* node = static_cast<FreeNode*>(p);
+    node->next = cache.free[c];
+    cache.free[c] = node;
+}
+
+#else
+
+void* pool_alloc(size_t size)
+{
+    return ::operator new(size);
+}
+
+void pool_free(void* p, size_t)
+{
+    ::operator delete(p);
+}
+
+#endif
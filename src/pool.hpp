@@ -0,0 +1,19 @@
+#ifndef POOL
+#define POOL
+
+#include <cstddef>
+
+/* size-class allocator for runtime objects (values and frames)
+ * every size up to POOL_MAX_SIZE is rounded to a multiple of POOL_GRAIN and served
+ * from a free list of that class, refilled a slab at a time; each thread keeps its
+ * own free lists, so no locking is needed
+ * building with SYSTEM_ALLOCATOR forwards everything to ::operator new/delete */
+
+const size_t POOL_GRAIN = 16;
+const size_t POOL_MAX_SIZE = 256;
+const size_t POOL_SLAB_SIZE = 64 * 1024;
+
+void* pool_alloc(size_t);
+void pool_free(void*, size_t);
+
+#endif
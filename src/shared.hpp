@@ -1,22 +1,55 @@
 #ifndef UNIQUE_PTR
 #define UNIQUE_PTR
 
+#include <cstddef>
 #include <functional>
 
+#ifndef PARALLEL_OPTIMIZE
+typedef size_t count_type;
+#else
+#include <atomic>
+typedef std::atomic<size_t> count_type;
+#endif
+
+/* the reference count lives in the header of every object owned by SharedPtr,
+ * so owning an object needs no allocation besides the object itself */
+struct RefCounted {
+    count_type ref_count;
+    RefCounted()
+        : ref_count(0)
+    {
+    }
+    RefCounted(const RefCounted&)
+        : ref_count(0)
+    {
+    }
+    RefCounted& operator=(const RefCounted&)
+    {
+        return *this;
+    }
+};
+
+/* how an object is freed once its count drops to zero, types with their own
+ * layout (e.g. frames with inline slots) overload this */
+template <typename T>
+void dispose(T* ptr)
+{
+    delete ptr;
+}
+
 template <typename T>
 class SharedPtr {
 public:
     SharedPtr()
     {
         ptr = nullptr;
-        count = nullptr;
         return;
     }
     explicit SharedPtr(T* pointer)
     {
         ptr = pointer;
         if (ptr != nullptr)
-            count = new size_t(1);
+            ptr->ref_count++;
         return;
     }
     ~SharedPtr()
@@ -27,13 +60,9 @@ public:
     void del()
     {
         if (ptr != nullptr) {
-            (*count)--;
-            if (*count == 0) {
-                delete ptr;
-                delete count;
-            }
+            if (--ptr->ref_count == 0)
+                dispose(ptr);
             ptr = nullptr;
-            count = nullptr;
         }
         return;
     }
@@ -41,19 +70,32 @@ public:
     SharedPtr(const SharedPtr& other)
     {
         ptr = other.ptr;
-        count = other.count;
         if (ptr != nullptr)
-            (*count)++;
+            ptr->ref_count++;
+        return;
+    }
+    SharedPtr(SharedPtr&& other) noexcept
+    {
+        ptr = other.ptr;
+        other.ptr = nullptr;
         return;
     }
     SharedPtr& operator=(const SharedPtr& other)
     {
         if (ptr != other.ptr) {
+            if (other.ptr != nullptr)
+                other.ptr->ref_count++;
+            del();
+            ptr = other.ptr;
+        }
+        return *this;
+    }
+    SharedPtr& operator=(SharedPtr&& other) noexcept
+    {
+        if (this != &other) {
             del();
             ptr = other.ptr;
-            count = other.count;
-            if (ptr != nullptr)
-                (*count)++;
+            other.ptr = nullptr;
         }
         return *this;
     }
@@ -64,9 +106,9 @@ public:
     }
     size_t use_count() const
     {
-        if (count == nullptr)
+        if (ptr == nullptr)
             return 0;
-        return *count;
+        return ptr->ref_count;
     }
     T* get() const
     {
@@ -88,17 +130,16 @@ public:
     void reset(T* new_pointer)
     {
         if (ptr != new_pointer) {
+            if (new_pointer != nullptr)
+                new_pointer->ref_count++;
             del();
             ptr = new_pointer;
-            if (ptr != nullptr)
-                count = new size_t(1);
         }
         return;
     }
 
 private:
     T* ptr;
-    size_t* count;
 };
 
 template <typename T, typename... argv>
@@ -107,4 +148,4 @@ SharedPtr<T> make_shared(argv&&... val)
     return SharedPtr<T>(new T(std::forward<argv>(val)...));
 }
 
-#endif // SHARED_PTR
\ No newline at end of file
+#endif // SHARED_PTR
@@ -1,4 +1,5 @@
 #include "syntax.hpp"
+#include "value.hpp"
 #include <cstring>
 #include <vector>
 
@@ -6,48 +7,104 @@ Syntax ::Syntax(SyntaxBase* stx)
     : ptr(stx)
 {
 }
-SyntaxBase* Syntax ::operator->() const { return ptr.get(); }
+SyntaxBase* Syntax ::operator->() const { return ptr; }
 SyntaxBase& Syntax ::operator*() { return *ptr; }
-SyntaxBase* Syntax ::get() const { return ptr.get(); }
+SyntaxBase* Syntax ::get() const { return ptr; }
+
+Scope ::Scope(const Scope* next)
+    : next(next)
+{
+}
+
+SyntaxBase ::SyntaxBase(SyntaxType st)
+    : s_type(st)
+{
+}
+
+List* asList(const Syntax& stx)
+{
+    return stx->s_type == S_LIST ? static_cast<List*>(stx.get()) : nullptr;
+}
+
+Identifier* asIdentifier(const Syntax& stx)
+{
+    return stx->s_type == S_IDENTIFIER ? static_cast<Identifier*>(stx.get()) : nullptr;
+}
 
 Number ::Number(int n)
-    : n(n)
+    : SyntaxBase(S_NUMBER)
+    , n(n)
 {
 }
 void Number::show(std::ostream& os)
 {
     os << "the-number-" << n;
 }
+SyntaxBase* Number::copy(Arena& arena)
+{
+    return arena.make<Number>(n);
+}
 
+TrueSyntax ::TrueSyntax()
+    : SyntaxBase(S_TRUE)
+{
+}
 void TrueSyntax::show(std::ostream& os)
 {
     os << "#t";
 }
+SyntaxBase* TrueSyntax::copy(Arena& arena)
+{
+    return arena.make<TrueSyntax>();
+}
 
+FalseSyntax ::FalseSyntax()
+    : SyntaxBase(S_FALSE)
+{
+}
 void FalseSyntax::show(std::ostream& os)
 {
     os << "#f";
 }
+SyntaxBase* FalseSyntax::copy(Arena& arena)
+{
+    return arena.make<FalseSyntax>();
+}
 
 Identifier ::Identifier(const std ::string& s1)
-    : s(s1)
+    : SyntaxBase(S_IDENTIFIER)
+    , s(intern(s1))
 {
 }
 void Identifier::show(std::ostream& os)
 {
-    os << s;
+    os << s->s;
+}
+SyntaxBase* Identifier::copy(Arena& arena)
+{
+    return arena.make<Identifier>(*this);
 }
 
-List ::List() { }
+List ::List()
+    : SyntaxBase(S_LIST)
+{
+}
 void List::show(std::ostream& os)
 {
     os << '(';
-    for (auto stx : stxs) {
+    for (const Syntax& stx : stxs) {
         stx->show(os);
         os << ' ';
     }
     os << ')';
 }
+SyntaxBase* List::copy(Arena& arena)
+{
+    List* list = arena.make<List>();
+    for (const Syntax& stx : stxs)
+        list->stxs.push_back(stx->copy(arena));
+    return list;
+}
 
 std::istream& readSpace(std::istream& is)
 {
@@ -56,18 +113,22 @@ std::istream& readSpace(std::istream& is)
     return is;
 }
 
-Syntax readList(std::istream& is);
+Syntax readList(std::istream& is, Arena& arena);
 
 // no leading space
-Syntax readItem(std::istream& is)
+Syntax readItem(std::istream& is, Arena& arena)
 {
     if (is.peek() == '(' || is.peek() == '[') {
         is.get();
-        return readList(is);
+        return readList(is, arena);
     }
+    // 'datum is read as (quote datum)
     if (is.peek() == '\'') {
         is.get();
-        return readList(is);
+        List* stx = arena.make<List>();
+        stx->stxs.push_back(Syntax(arena.make<Identifier>("quote")));
+        stx->stxs.push_back(readItem(readSpace(is), arena));
+        return Syntax(stx);
     }
     std::string s;
     do {
@@ -95,32 +156,26 @@ Syntax readItem(std::istream& is)
             goto identifier;
     if (neg)
         n = -n;
-    return Syntax(new Number(n));
+    return Syntax(arena.make<Number>(n));
 identifier:
     // not a number
     if (s == "#t")
-        return Syntax(new TrueSyntax());
+        return Syntax(arena.make<TrueSyntax>());
     if (s == "#f")
-        return Syntax(new FalseSyntax());
-    return Syntax(new Identifier(s));
+        return Syntax(arena.make<FalseSyntax>());
+    return Syntax(arena.make<Identifier>(s));
 }
 
-Syntax readList(std::istream& is)
+Syntax readList(std::istream& is, Arena& arena)
 {
-    List* stx = new List();
+    List* stx = arena.make<List>();
     while (readSpace(is).peek() != ')' && readSpace(is).peek() != ']')
-        stx->stxs.push_back(readItem(is));
+        stx->stxs.push_back(readItem(is, arena));
     is.get(); // ')'
     return Syntax(stx);
 }
 
-Syntax readSyntax(std::istream& is)
+Syntax readSyntax(std::istream& is, Arena& arena)
 {
-    return readItem(readSpace(is));
-}
-
-std::istream& operator>>(std::istream& is, Syntax& stx)
-{
-    stx = readSyntax(is);
-    return is;
+    return readItem(readSpace(is), arena);
 }
@@ -2,61 +2,80 @@
 #define SYNTAX
 
 #include "Def.hpp"
+#include "arena.hpp"
 #include "shared.hpp"
 #include <cstring>
 #include <memory>
 #include <vector>
 
+/* names bound by one let/lambda/letrec frame, used to resolve variables while parsing */
+struct Scope {
+    std::vector<Symbol*> x;
+    const Scope* next;
+    Scope(const Scope*);
+};
+
 struct SyntaxBase {
-    virtual Expr parse(Assoc&) = 0;
+    SyntaxType s_type;
+    SyntaxBase(SyntaxType);
+    virtual Expr parse(const Scope*) = 0;
     virtual void show(std::ostream&) = 0;
+    virtual SyntaxBase* copy(Arena&) = 0;
     virtual ~SyntaxBase() = default;
 };
 
+/* syntax nodes live in the arena they were read into, the handle does not own them */
 struct Syntax {
-    SharedPtr<SyntaxBase> ptr;
-    // std :: shared_ptr<SyntaxBase> ptr;
+    SyntaxBase* ptr;
     Syntax(SyntaxBase*);
     SyntaxBase* operator->() const;
     SyntaxBase& operator*();
     SyntaxBase* get() const;
-    Expr parse(Assoc&);
+    Expr parse(const Scope*);
 };
 
 struct Number : SyntaxBase {
     int n;
     Number(int);
-    virtual Expr parse(Assoc&) override;
+    virtual Expr parse(const Scope*) override;
     virtual void show(std::ostream&) override;
+    virtual SyntaxBase* copy(Arena&) override;
 };
 
 struct TrueSyntax : SyntaxBase {
-    // TrueSyntax();
-    virtual Expr parse(Assoc&) override;
+    TrueSyntax();
+    virtual Expr parse(const Scope*) override;
     virtual void show(std ::ostream&) override;
+    virtual SyntaxBase* copy(Arena&) override;
 };
 
 struct FalseSyntax : SyntaxBase {
-    // FalseSyntax();
-    virtual Expr parse(Assoc&) override;
+    FalseSyntax();
+    virtual Expr parse(const Scope*) override;
     virtual void show(std ::ostream&) override;
+    virtual SyntaxBase* copy(Arena&) override;
 };
 
 struct Identifier : SyntaxBase {
-    std::string s;
+    Symbol* s; // interned name
     Identifier(const std::string&);
-    virtual Expr parse(Assoc&) override;
+    virtual Expr parse(const Scope*) override;
     virtual void show(std::ostream&) override;
+    virtual SyntaxBase* copy(Arena&) override;
 };
 
 struct List : SyntaxBase {
     std ::vector<Syntax> stxs;
     List();
-    virtual Expr parse(Assoc&) override;
+    virtual Expr parse(const Scope*) override;
     virtual void show(std::ostream&) override;
+    virtual SyntaxBase* copy(Arena&) override;
 };
 
-Syntax readSyntax(std::istream&);
+/* the node as a list or an identifier, nullptr if it is something else */
+List* asList(const Syntax&);
+Identifier* asIdentifier(const Syntax&);
 
-std::istream& operator>>(std::istream&, Syntax);
+Syntax readSyntax(std::istream&, Arena&);
+std::istream& readSpace(std::istream&); // skip to the next item
 #endif
\ No newline at end of file
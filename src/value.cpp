@@ -1,110 +1,181 @@
 #include "value.hpp"
+#include <new>
+#include <unordered_map>
 
-AssocList::AssocList(const std::string& x, const Value& v, Assoc& next)
-    : x(x)
-    , v(v)
+AssocList::AssocList(int n, const Assoc& next)
+    : GcNode(GC_FRAME)
     , next(next)
+    , n(n)
 {
+    Value* v = slots();
+    for (int i = 0; i < n; i++)
+        new (v + i) Value(nullptr);
 }
 
-Assoc::Assoc(AssocList* x)
-    : ptr(x)
+AssocList::~AssocList()
 {
+    Value* v = slots();
+    for (int i = 0; i < n; i++)
+        v[i].~Value();
 }
-AssocList* Assoc ::operator->() const { return ptr.get(); }
-AssocList& Assoc ::operator*() { return *ptr; }
-AssocList* Assoc ::get() const { return ptr.get(); }
 
-Assoc empty()
+Value* AssocList::slots()
 {
-    return Assoc(nullptr);
+    return reinterpret_cast<Value*>(this + 1);
 }
 
-Assoc extend(const std::string& x, const Value& v, Assoc& lst)
+size_t AssocList::size(int n)
 {
-    return Assoc(new AssocList(x, v, lst));
+    static_assert(sizeof(AssocList) % alignof(Value) == 0, "slots must be aligned");
+    return sizeof(AssocList) + n * sizeof(Value);
 }
 
-void modify(const std::string& x, const Value& v, Assoc& lst)
+/* exactly one of the two is set */
+struct Doomed {
+    ValueBase* value;
+    AssocList* frame;
+};
+
+static thread_local std::vector<Doomed> doomed;
+static thread_local bool reclaiming = false;
+
+static void destroy(const Doomed& d)
 {
-    for (auto i = lst; i.get() != nullptr; i = i->next)
-        if (x == i->x) {
-            i->v = v;
-            return;
-        }
+    if (d.value != nullptr) {
+        delete d.value;
+        return;
+    }
+    size_t size = AssocList::size(d.frame->n);
+    d.frame->~AssocList();
+    pool_free(d.frame, size);
 }
 
-Value find(const std::string& x, Assoc& l)
-{
-    for (auto i = l; i.get() != nullptr; i = i->next)
-        if (x == i->x)
-            return i->v;
-    return Value(nullptr);
+/* an object freed while freeing another one is queued instead of destroyed
+ * in place, the outermost call drains the queue */
+static void reclaim(const Doomed& d)
+{
+    if (reclaiming) {
+        doomed.push_back(d);
+        return;
+    }
+    reclaiming = true;
+    destroy(d);
+    while (!doomed.empty()) {
+        Doomed next = doomed.back();
+        doomed.pop_back();
+        destroy(next);
+    }
+    reclaiming = false;
 }
 
-std::ostream& operator<<(std::ostream& os, Value& v)
+void dispose(ValueBase* value)
 {
-    v->show(os);
-    return os;
+    reclaim({ value, nullptr });
 }
 
-void ValueBase::showCdr(std::ostream& os)
+void dispose(AssocList* frame)
 {
-    os << " . ";
-    show(os);
-    os << ')';
+    reclaim({ nullptr, frame });
 }
 
-void Void::show(std::ostream& os)
+Assoc::Assoc(AssocList* x)
+    : ptr(x)
 {
-    os << "#<void>";
 }
+AssocList* Assoc ::operator->() const { return ptr.get(); }
+AssocList& Assoc ::operator*() { return *ptr; }
+AssocList* Assoc ::get() const { return ptr.get(); }
 
-void Integer::show(std::ostream& os)
+Assoc empty()
 {
-    os << n;
+    return Assoc(nullptr);
 }
 
-void Boolean::show(std::ostream& os)
+/* a new frame of n slots on top of lst */
+Assoc extend(int n, const Assoc& lst)
 {
-    os << (b ? "#t" : "#f");
+    gcMaybeCollect();
+    return Assoc(new (pool_alloc(AssocList::size(n))) AssocList(n, lst));
 }
 
-void Symbol::show(std::ostream& os)
+/* the slot resolved by the parser as (depth, index) */
+Value& find(int depth, int index, const Assoc& l)
 {
-    os << s;
+    AssocList* frame = l.get();
+    while (depth--)
+        frame = frame->next.get();
+    return frame->slots()[index];
 }
 
-void Null::show(std::ostream& os)
+std::ostream& operator<<(std::ostream& os, const Value& v)
 {
-    os << "()";
+    v.show(os);
+    return os;
 }
 
-void Null::showCdr(std::ostream& os)
-{
-    os << ')';
+void Value::show(std::ostream& os) const
+{
+    switch (bits) {
+    case FALSE:
+        os << "#f";
+        return;
+    case TRUE:
+        os << "#t";
+        return;
+    case NIL:
+        os << "()";
+        return;
+    case VOID:
+        os << "#<void>";
+        return;
+    case NOTHING:
+        os << "#<nothing>";
+        return;
+    case TERMINATE:
+        os << "()";
+        return;
+    }
+    if (bits & 1)
+        os << integer();
+    else
+        get()->show(os);
+}
+
+void Value::showCdr(std::ostream& os) const
+{
+    if (bits == NIL)
+        os << ')';
+    else if (boxed())
+        get()->showCdr(os);
+    else {
+        os << " . ";
+        show(os);
+        os << ')';
+    }
 }
 
-void Nothing::show(std::ostream& os)
+void ValueBase::showCdr(std::ostream& os)
 {
-    os << "#<nothing>";
+    os << " . ";
+    show(os);
+    os << ')';
 }
 
-void Terminate::show(std::ostream& os)
+void Symbol::show(std::ostream& os)
 {
-    os << "()";
+    os << s;
 }
 
 void Pair::show(std::ostream& os)
 {
     os << '(' << car;
-    cdr->showCdr(os);
+    cdr.showCdr(os);
 }
 
 void Pair::showCdr(std::ostream& os)
 {
     os << ' ' << car;
-    cdr->showCdr(os);
+    cdr.showCdr(os);
 }
 
 void Closure::show(std::ostream& os)
@@ -112,104 +183,244 @@ void Closure::show(std::ostream& os)
     os << "#<procedure>";
 }
 
-ValueBase ::ValueBase(ValueType vt)
-    : v_type(vt)
+void Continuation::show(std::ostream& os)
 {
+    os << "#<procedure>";
 }
 
-Value ::Value(ValueBase* ptr)
-    : ptr(ptr)
+ValueBase ::ValueBase(ValueType vt)
+    : v_type(vt)
 {
 }
-ValueBase* Value ::operator->() const { return ptr.get(); }
-ValueBase& Value ::operator*() { return *ptr; }
-ValueBase* Value ::get() const { return ptr.get(); }
-
-Void::Void()
-    : ValueBase(V_VOID)
+void* ValueBase::operator new(size_t size)
 {
+    return pool_alloc(size);
 }
-Value VoidV()
+void ValueBase::operator delete(void* p, size_t size)
 {
-    return Value(new Void());
+    pool_free(p, size);
 }
 
-Integer::Integer(int n)
-    : ValueBase(V_INT)
-    , n(n)
+
+Value VoidV()
 {
+    return Value::immediate(Value::VOID);
 }
+
 Value IntegerV(int n)
 {
-    return Value(new Integer(n));
+    return Value::immediate(static_cast<uintptr_t>(n) << 1 | 1);
 }
 
-Boolean::Boolean(bool b)
-    : ValueBase(V_BOOL)
-    , b(b)
-{
-}
 Value BooleanV(bool b)
 {
-    return Value(new Boolean(b));
+    return Value::immediate(b ? Value::TRUE : Value::FALSE);
 }
 
-Symbol::Symbol(const std::string& s)
+Symbol::Symbol(const std::string& s, int id)
     : ValueBase(V_SYM)
     , s(s)
+    , id(id)
 {
 }
-Value SymbolV(const std::string& s)
+
+/* the intern table, symbols live as long as the process */
+static std::unordered_map<std::string, int> symbol_ids;
+static std::vector<Value> symbols;
+
+Symbol* intern(const std::string& s)
 {
-    return Value(new Symbol(s));
+    auto it = symbol_ids.find(s);
+    if (it != symbol_ids.end())
+        return static_cast<Symbol*>(symbols[it->second].get());
+    int id = symbols.size();
+    Symbol* sym = new Symbol(s, id);
+    symbols.push_back(Value(sym));
+    symbol_ids[s] = id;
+    return sym;
 }
-
-Null::Null()
-    : ValueBase(V_NULL)
+Value SymbolV(const std::string& s)
 {
+    return symbols[intern(s)->id];
 }
-Value NullV()
+Value SymbolV(Symbol* sym)
 {
-    return Value(new Null());
+    return symbols[sym->id];
 }
 
-Nothing::Nothing()
-    : ValueBase(V_NOTHING)
+Value NullV()
 {
+    return Value::immediate(Value::NIL);
 }
+
 Value NothingV()
 {
-    return Value(new Nothing());
+    return Value::immediate(Value::NOTHING);
 }
 
-Terminate::Terminate()
-    : ValueBase(V_TERMINATE)
-{
-}
 Value TerminateV()
 {
-    return Value(new Terminate());
+    return Value::immediate(Value::TERMINATE);
 }
 
 Pair::Pair(const Value& car, const Value& cdr)
     : ValueBase(V_PAIR)
+    , GcNode(GC_PAIR)
     , car(car)
     , cdr(cdr)
 {
 }
 Value PairV(const Value& car, const Value& cdr)
 {
+    gcMaybeCollect();
     return Value(new Pair(car, cdr));
 }
 
-Closure::Closure(const std::vector<std::string>& xs, const Expr& e, const Assoc& env)
+Closure::Closure(Lambda* lambda, const Assoc& env)
+    : ValueBase(V_PROC)
+    , GcNode(GC_CLOSURE)
+    , arity(lambda->x.size())
+    , e(lambda->e)
+    , env(env)
+    , form(lambda->form)
+    , lambda(lambda)
+    , code(nullptr)
+    , compiled(nullptr)
+{
+}
+Closure::Closure(int arity, CompiledBody body, const Assoc& env)
     : ValueBase(V_PROC)
-    , parameters(xs)
-    , e(e)
+    , GcNode(GC_CLOSURE)
+    , arity(arity)
+    , e(nullptr)
     , env(env)
+    , form(nullptr)
+    , lambda(nullptr)
+    , code(nullptr)
+    , compiled(body)
+{
+}
+Value ClosureV(Lambda* lambda, const Assoc& env)
+{
+    gcMaybeCollect();
+    if (!lambda->flat)
+        return Value(new Closure(lambda, env));
+
+    /* only what the body reads is kept alive by the closure */
+    Assoc frame = extend(lambda->captured.size(), empty());
+    for (int i = 0; i < lambda->captured.size(); i++)
+        frame->slots()[i] = find(lambda->captured[i].first, lambda->captured[i].second, env);
+    return Value(new Closure(lambda, frame));
+}
+
+Continuation::Continuation(const std::vector<Kont>& stack, bool escape)
+    : ValueBase(V_CONT)
+    , GcNode(GC_CONT)
+    , stack(stack)
+    , escape(escape)
+    , active(true)
+{
+}
+PrimitiveProc::PrimitiveProc(const Primitive* primitive)
+    : ValueBase(V_PRIMITIVE)
+    , primitive(primitive)
+{
+}
+void PrimitiveProc::show(std::ostream& os)
+{
+    os << "#<procedure>";
+}
+Value PrimitiveV(ExprType op)
+{
+    /* like symbols, they live as long as the process */
+    static std::vector<Value> values(E_GETTYPE + 1, Value(nullptr));
+    if (values[op].bits == 0)
+        values[op] = Value(new PrimitiveProc(primitiveOf(op)));
+    return values[op];
+}
+
+int memo_limit = 100000;
+
+/* totals over every memo made */
+static size_t memo_hits = 0, memo_misses = 0, memos = 0;
+
+size_t Memo::KeyHash::operator()(const std::vector<uintptr_t>& key) const
+{
+    size_t h = key.size();
+    for (uintptr_t bits : key)
+        h = h * 31 + std::hash<uintptr_t>()(bits);
+    return h;
+}
+Memo::Memo(const Value& f)
+    : ValueBase(V_MEMO)
+    , GcNode(GC_MEMO)
+    , f(f)
+    , hits(0)
+    , misses(0)
+{
+    memos++;
+}
+void Memo::show(std::ostream& os)
+{
+    os << "#<procedure>";
+}
+
+/* symbols are interned and never freed, so the bits of such values stand for them */
+static bool memoKey(const Value* args, int n, std::vector<uintptr_t>& key)
+{
+    for (int i = 0; i < n; i++) {
+        if (args[i].boxed() && args[i]->v_type != V_SYM)
+            return false;
+        key.push_back(args[i].bits);
+    }
+    return true;
+}
+const Value* Memo::lookup(const Value* args, int n)
+{
+    std::vector<uintptr_t> key;
+    if (!memoKey(args, n, key))
+        return nullptr;
+    auto it = cache.find(key);
+    if (it == cache.end()) {
+        misses++;
+        memo_misses++;
+        return nullptr;
+    }
+    hits++;
+    memo_hits++;
+    return &it->second;
+}
+void Memo::store(const Value* args, int n, const Value& v)
+{
+    std::vector<uintptr_t> key;
+    if (!memoKey(args, n, key))
+        return;
+    auto inserted = cache.emplace(std::move(key), v);
+    if (!inserted.second)
+        return;
+    order.push_back(&inserted.first->first);
+    if (cache.size() > static_cast<size_t>(memo_limit)) {
+        cache.erase(cache.find(*order.front()));
+        order.pop_front();
+    }
+}
+Value MemoV(const Value& f)
+{
+    gcMaybeCollect();
+    return Value(new Memo(f));
+}
+void memoShowStats(std::ostream& os)
+{
+    os << "memo: " << memos << " memos, " << memo_hits << " hits, " << memo_misses << " misses" << std::endl;
+}
+
+Value ContinuationV(const std::vector<Kont>& stack)
 {
+    gcMaybeCollect();
+    return Value(new Continuation(stack, false));
 }
-Value ClosureV(const std::vector<std::string>& xs, const Expr& e, const Assoc& env)
+Value EscapeV()
 {
-    return Value(new Closure(xs, e, env));
+    gcMaybeCollect();
+    return Value(new Continuation(std::vector<Kont>(), true));
 }
@@ -3,26 +3,138 @@
 
 #include "Def.hpp"
 #include "expr.hpp"
+#include "gc.hpp"
+#include "pool.hpp"
 #include "shared.hpp"
+#include <cstdint>
 #include <cstring>
+#include <deque>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
-struct ValueBase {
+struct ValueBase : RefCounted {
     ValueType v_type;
     ValueBase(ValueType);
+    static void* operator new(size_t);
+    static void operator delete(void*, size_t);
     virtual void show(std::ostream&) = 0;
     virtual void showCdr(std::ostream&);
     virtual ~ValueBase() = default;
 };
+void dispose(ValueBase*);
 
+/* a word-sized handle, fixnums and the constants below are stored in the word itself,
+ * everything else is a reference counted pointer to a ValueBase
+ *   ...xxx1  fixnum, the int is in the upper bits
+ *   ...k10   constant number k
+ *   ...x00   pointer to ValueBase (nullptr for an unset value), owning one count of its RefCounted header */
 struct Value {
-    SharedPtr<ValueBase> ptr;
-    Value(ValueBase*);
-    void show(std::ostream&);
-    ValueBase* operator->() const;
-    ValueBase& operator*();
-    ValueBase* get() const;
+    enum : uintptr_t {
+        FALSE = 0 << 2 | 2,
+        TRUE = 1 << 2 | 2,
+        NIL = 2 << 2 | 2,
+        VOID = 3 << 2 | 2,
+        NOTHING = 4 << 2 | 2,
+        TERMINATE = 5 << 2 | 2
+    };
+    uintptr_t bits;
+
+    Value(ValueBase* ptr)
+        : bits(reinterpret_cast<uintptr_t>(ptr))
+    {
+        if (ptr != nullptr)
+            ptr->ref_count++;
+    }
+    static Value immediate(uintptr_t bits)
+    {
+        Value v(nullptr);
+        v.bits = bits;
+        return v;
+    }
+    Value(const Value& other)
+        : bits(other.bits)
+    {
+        if (boxed())
+            get()->ref_count++;
+    }
+    Value(Value&& other) noexcept
+        : bits(other.bits)
+    {
+        other.bits = 0;
+    }
+    Value& operator=(const Value& other)
+    {
+        if (other.boxed())
+            other.get()->ref_count++;
+        release();
+        bits = other.bits;
+        return *this;
+    }
+    Value& operator=(Value&& other) noexcept
+    {
+        if (this != &other) {
+            release();
+            bits = other.bits;
+            other.bits = 0;
+        }
+        return *this;
+    }
+    ~Value()
+    {
+        release();
+    }
+    void release()
+    {
+        if (boxed() && --get()->ref_count == 0)
+            dispose(get());
+    }
+
+    bool boxed() const
+    {
+        return (bits & 3) == 0 && bits != 0;
+    }
+    ValueType type() const
+    {
+        if (bits & 1)
+            return V_INT;
+        if (bits & 2) {
+            switch (bits) {
+            case FALSE:
+            case TRUE:
+                return V_BOOL;
+            case NIL:
+                return V_NULL;
+            case VOID:
+                return V_VOID;
+            case NOTHING:
+                return V_NOTHING;
+            default:
+                return V_TERMINATE;
+            }
+        }
+        return get()->v_type;
+    }
+    int integer() const
+    {
+        return static_cast<int>(static_cast<intptr_t>(bits) >> 1);
+    }
+    bool boolean() const
+    {
+        return bits == TRUE;
+    }
+    bool operator==(const Value& other) const
+    {
+        return bits == other.bits;
+    }
+
+    void show(std::ostream&) const;
+    void showCdr(std::ostream&) const;
+    ValueBase* operator->() const { return get(); }
+    ValueBase* get() const
+    {
+        return (bits & 3) == 0 ? reinterpret_cast<ValueBase*>(bits) : nullptr;
+    }
 };
 
 struct Assoc {
@@ -33,76 +145,162 @@ struct Assoc {
     AssocList* get() const;
 };
 
-struct AssocList {
-    std::string x;
-    Value v;
+/* one activation frame of let/lambda/letrec, slots are stored right after the header */
+struct AssocList : RefCounted, GcNode {
     Assoc next;
-    AssocList(const std::string&, const Value&, Assoc&);
+    int n;
+    AssocList(int, const Assoc&);
+    ~AssocList();
+    Value* slots();
+    static size_t size(int);
 };
+/* objects are freed from a worklist, so dropping a long list or a deep chain of
+ * frames takes constant native stack */
+void dispose(AssocList*);
 
-struct Void : ValueBase {
-    Void();
-    virtual void show(std::ostream&) override;
-};
 Value VoidV();
-
-struct Integer : ValueBase {
-    int n;
-    Integer(int);
-    virtual void show(std::ostream&) override;
-};
 Value IntegerV(int);
-
-struct Boolean : ValueBase {
-    bool b;
-    Boolean(bool);
-    virtual void show(std::ostream&) override;
-};
 Value BooleanV(bool);
+Value NullV();
+Value NothingV();
+Value TerminateV();
 
+/* symbols are interned, so equal names are the same object */
 struct Symbol : ValueBase {
     std::string s;
-    Symbol(const std::string&);
+    int id; // index in the intern table
+    Symbol(const std::string&, int);
     virtual void show(std::ostream&) override;
 };
+Symbol* intern(const std::string&);
 Value SymbolV(const std::string&);
+Value SymbolV(Symbol*);
 
-struct Null : ValueBase {
-    Null();
+struct Pair : ValueBase, GcNode {
+    Value car;
+    Value cdr;
+    Pair(const Value&, const Value&);
     virtual void show(std::ostream&) override;
     virtual void showCdr(std::ostream&) override;
 };
-Value NullV();
+Value PairV(const Value&, const Value&);
+
+/* the body of a lambda compiled to C++ by --emit-cpp (aot.hpp): it runs in the frame
+ * env and returns the value, or makes a tail call by setting env and self to the callee
+ * and its frame and returning an unset Value */
+typedef Value (*CompiledBody)(Assoc& env, Value& self);
 
-struct Nothing : ValueBase {
-    Nothing();
+struct Closure : ValueBase, GcNode {
+    int arity;
+    Expr e;
+    Assoc env; // a frame of the captured slots when lambda is flat
+    SharedPtr<ExprArena> form; // owns e
+    Lambda* lambda; // the node it was made from, in form
+    Code* code; // e compiled for the VM, in form, nullptr until it is needed
+    CompiledBody compiled; // instead of all of the above in a compiled program
+    Closure(Lambda*, const Assoc&);
+    Closure(int, CompiledBody, const Assoc&);
     virtual void show(std::ostream&) override;
 };
-Value NothingV();
+Value ClosureV(Lambda*, const Assoc&);
 
-struct Terminate : ValueBase {
-    Terminate();
+/* a primitive as a value, called without a closure around it */
+struct PrimitiveProc : ValueBase {
+    const Primitive* primitive;
+    PrimitiveProc(const Primitive*);
     virtual void show(std::ostream&) override;
 };
-Value TerminateV();
+/* the value of the primitive of a node type, the same object every time */
+Value PrimitiveV(ExprType);
 
-struct Pair : ValueBase {
-    Value car;
-    Value cdr;
-    Pair(const Value&, const Value&);
+/* a procedure made by (memoize f): a call whose arguments are all immediates (fixnums,
+ * booleans, (), #<void>) or symbols returns the value the first such call of f
+ * returned, the others call f. a cache keeps at most memo_limit values, storing one
+ * more drops the oldest */
+struct Memo : ValueBase, GcNode {
+    struct KeyHash {
+        size_t operator()(const std::vector<uintptr_t>&) const;
+    };
+    Value f;
+    std::unordered_map<std::vector<uintptr_t>, Value, KeyHash> cache;
+    std::deque<const std::vector<uintptr_t>*> order; // the keys of cache, oldest first
+    size_t hits, misses; // of calls with a key
+    Memo(const Value&);
+    const Value* lookup(const Value* args, int n); // nullptr if it is not cached
+    void store(const Value* args, int n, const Value&); // the value of a lookup that missed
     virtual void show(std::ostream&) override;
-    virtual void showCdr(std::ostream&) override;
 };
-Value PairV(const Value&, const Value&);
+Value MemoV(const Value&);
+extern int memo_limit; // --memo-limit=N
+void memoShowStats(std::ostream&); // the calls of the memos made so far
 
-struct Closure : ValueBase {
-    std::vector<std::string> parameters;
-    Expr e;
+/* one frame of the CEK machine's continuation stack: node e waits for a value,
+ * i, frame and v hold what it has collected so far */
+enum KontType {
+    K_IF,
+    K_BEGIN, // i: the expression being evaluated
+    K_LET, // i: the binding being evaluated, frame: the new frame
+    K_LETREC, // i: the binding being evaluated, frame: the values so far
+    K_RATOR,
+    K_RAND, // i: the argument being evaluated, frame: the new frame, v: the callee
+    K_BINARY, // i: the operand being evaluated, v: the first operand
+    K_UNARY,
+    K_CALLCC,
+    K_MEMO // frame: the arguments of a call that missed, v: the memo
+};
+
+struct Kont {
+    KontType k;
+    ExprBase* e;
     Assoc env;
-    Closure(const std::vector<std::string>&, const Expr&, const Assoc&);
+    int i;
+    Assoc frame;
+    Value v;
+    Value owner; // the closure whose body e is in, keeps its arena alive
+};
+
+/* the CEK machine captures the whole stack, the tree evaluator can only escape to
+ * a call/cc that has not returned yet */
+struct Continuation : ValueBase, GcNode {
+    std::vector<Kont> stack;
+    bool escape;
+    bool active;
+    Continuation(const std::vector<Kont>&, bool);
     virtual void show(std::ostream&) override;
 };
-Value ClosureV(const std::vector<std::string>&, const Expr&, const Assoc&);
+Value ContinuationV(const std::vector<Kont>&);
+Value EscapeV();
+
+/* calling an escape continuation throws back to its call/cc */
+[[noreturn]] void escapeTo(Continuation*, const Value&);
+/* call/cc with an escape continuation, run evaluates the body of a closure */
+Value callEscape(const Value&, Value (*run)(Closure*, const Assoc&));
+/* call any procedure on n values, checked like Apply, run as above */
+Value callValue(const Value&, const Value* args, int n, Value (*run)(Closure*, const Assoc&));
+
+/* the primitives on their argument values, called by the evalRator of their nodes
+ * and by the registry in Def.cpp; primCallCC is the tree evaluator's call/cc */
+Value primMult(const Value&, const Value&);
+Value primPlus(const Value&, const Value&);
+Value primMinus(const Value&, const Value&);
+Value primLess(const Value&, const Value&);
+Value primLessEq(const Value&, const Value&);
+Value primEqual(const Value&, const Value&);
+Value primGreaterEq(const Value&, const Value&);
+Value primGreater(const Value&, const Value&);
+Value primIsEq(const Value&, const Value&);
+Value primCons(const Value&, const Value&);
+Value primIsBoolean(const Value&);
+Value primIsFixnum(const Value&);
+Value primIsSymbol(const Value&);
+Value primIsNull(const Value&);
+Value primIsPair(const Value&);
+Value primIsProcedure(const Value&);
+Value primMemoize(const Value&);
+Value primCallCC(const Value&);
+Value primNot(const Value&);
+Value primCar(const Value&);
+Value primCdr(const Value&);
 
 struct String : ValueBase {
     std ::string s;
@@ -111,10 +309,9 @@ struct String : ValueBase {
 };
 Value StringV(const std ::string&);
 
-std::ostream& operator<<(std::ostream&, Value&);
+std::ostream& operator<<(std::ostream&, const Value&);
 
 Assoc empty();
-Assoc extend(const std ::string&, const Value&, Assoc&);
-void modify(const std ::string&, const Value&, Assoc&);
-Value find(const std::string&, Assoc&);
+Assoc extend(int, const Assoc&);
+Value& find(int, int, const Assoc&);
 #endif
\ No newline at end of file
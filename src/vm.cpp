@@ -0,0 +1,710 @@
+#include "vm.hpp"
+#include "RE.hpp"
+#include "value.hpp"
+#include <algorithm>
+
+Code ::Code()
+    : max_stack(0)
+{
+}
+
+/* compiling one body, depth follows the operand stack to size it */
+struct Compiler {
+    Code* code;
+    int depth;
+    Compiler(Code*);
+    void emit(intptr_t);
+    void push(int);
+    int jump(OpCode); // the offset word, patched later
+    void patch(int); // make the jump land on the next instruction
+    void expr(ExprBase*, bool);
+};
+
+Compiler ::Compiler(Code* code)
+    : code(code)
+    , depth(0)
+{
+}
+
+void Compiler::emit(intptr_t word)
+{
+    code->ops.push_back(word);
+}
+
+void Compiler::push(int n)
+{
+    depth += n;
+    code->max_stack = std::max(code->max_stack, depth);
+}
+
+int Compiler::jump(OpCode op)
+{
+    emit(op);
+    emit(0);
+    return code->ops.size() - 1;
+}
+
+void Compiler::patch(int at)
+{
+    code->ops[at] = code->ops.size() - at;
+}
+
+/* a node in tail position leaves through OP_RETURN or OP_TAIL_CALL */
+void Compiler::expr(ExprBase* e, bool tail)
+{
+    switch (e->e_type) {
+    case E_FIXNUM:
+        emit(OP_CONST);
+        emit(IntegerV(static_cast<Fixnum*>(e)->n).bits);
+        push(1);
+        break;
+    case E_TRUE:
+        emit(OP_CONST);
+        emit(BooleanV(true).bits);
+        push(1);
+        break;
+    case E_FALSE:
+        emit(OP_CONST);
+        emit(BooleanV(false).bits);
+        push(1);
+        break;
+    case E_VOID:
+        emit(OP_CONST);
+        emit(VoidV().bits);
+        push(1);
+        break;
+    case E_VAR: {
+        Var* var = static_cast<Var*>(e);
+        if (var->depth < 0) { // raises the error when it is reached
+            emit(OP_EVAL);
+            emit(reinterpret_cast<intptr_t>(e));
+        } else if (var->depth == 0) {
+            emit(OP_LOCAL);
+            emit(var->index);
+        } else {
+            emit(OP_VAR);
+            emit(var->depth);
+            emit(var->index);
+        }
+        push(1);
+        break;
+    }
+    case E_LAMBDA: {
+        Lambda* lambda = static_cast<Lambda*>(e);
+        if (lambda->code == nullptr)
+            lambda->code = compile(lambda->e.get(), lambda->form->arena);
+        emit(OP_CLOSURE);
+        emit(reinterpret_cast<intptr_t>(lambda));
+        push(1);
+        break;
+    }
+    case E_IF: {
+        If* node = static_cast<If*>(e);
+        expr(node->cond.get(), false);
+        int to_alter = jump(OP_JUMP_FALSE);
+        push(-1);
+        int d = depth;
+        expr(node->conseq.get(), tail);
+        int to_end = tail ? -1 : jump(OP_JUMP);
+        patch(to_alter);
+        depth = d;
+        expr(node->alter.get(), tail);
+        if (!tail)
+            patch(to_end);
+        return;
+    }
+    case E_BEGIN: {
+        Begin* node = static_cast<Begin*>(e);
+        for (int i = 0; i + 1 < node->es.size(); i++) {
+            expr(node->es[i].get(), false);
+            emit(OP_POP);
+            push(-1);
+        }
+        expr(node->es.back().get(), tail);
+        return;
+    }
+    case E_LET: {
+        Let* node = static_cast<Let*>(e);
+        for (const auto& b : node->bind)
+            expr(b.second.get(), false);
+        emit(OP_LET);
+        emit(node->bind.size());
+        push(-node->bind.size());
+        expr(node->body.get(), tail);
+        if (!tail)
+            emit(OP_UNLET);
+        return;
+    }
+    case E_LETREC: {
+        Letrec* node = static_cast<Letrec*>(e);
+        emit(OP_LETREC);
+        emit(node->bind.size());
+        for (const auto& b : node->bind)
+            expr(b.second.get(), false);
+        emit(OP_SET_FRAME);
+        emit(reinterpret_cast<intptr_t>(node));
+        push(-node->bind.size());
+        expr(node->body.get(), tail);
+        if (!tail)
+            emit(OP_UNLET);
+        return;
+    }
+    case E_APPLY: {
+        Apply* node = static_cast<Apply*>(e);
+        expr(node->rator.get(), false);
+        emit(OP_CHECK_CALLEE);
+        emit(node->rand.size());
+        for (const Expr& rand : node->rand)
+            expr(rand.get(), false);
+        emit(tail ? OP_TAIL_CALL : OP_CALL);
+        emit(node->rand.size());
+        push(-node->rand.size());
+        return;
+    }
+    case E_PLUS:
+    case E_MINUS:
+    case E_MUL:
+    case E_LT:
+    case E_LE:
+    case E_EQ:
+    case E_GE:
+    case E_GT:
+    case E_EQQ:
+    case E_CONS: {
+        Binary* node = static_cast<Binary*>(e);
+        expr(node->rand1.get(), false);
+        expr(node->rand2.get(), false);
+        switch (e->e_type) {
+        case E_PLUS:
+            emit(node->fixnums ? OP_ADD_FIXNUMS : OP_ADD);
+            break;
+        case E_MINUS:
+            emit(node->fixnums ? OP_SUB_FIXNUMS : OP_SUB);
+            break;
+        case E_MUL:
+            emit(node->fixnums ? OP_MUL_FIXNUMS : OP_MUL);
+            break;
+        case E_LT:
+            emit(node->fixnums ? OP_LT_FIXNUMS : OP_LT);
+            break;
+        case E_LE:
+            emit(node->fixnums ? OP_LE_FIXNUMS : OP_LE);
+            break;
+        case E_EQ:
+            emit(node->fixnums ? OP_NUM_EQ_FIXNUMS : OP_NUM_EQ);
+            break;
+        case E_GE:
+            emit(node->fixnums ? OP_GE_FIXNUMS : OP_GE);
+            break;
+        case E_GT:
+            emit(node->fixnums ? OP_GT_FIXNUMS : OP_GT);
+            break;
+        case E_EQQ:
+            emit(OP_EQ);
+            break;
+        default:
+            emit(OP_CONS);
+            break;
+        }
+        push(-1);
+        break;
+    }
+    case E_CAR:
+    case E_CDR:
+    case E_NOT:
+    case E_NULLQ:
+    case E_PAIRQ:
+    case E_BOOLQ:
+    case E_INTQ:
+    case E_SYMBOLQ:
+    case E_PROCQ:
+    case E_MEMO:
+    case E_CALLCC: {
+        Unary* node = static_cast<Unary*>(e);
+        expr(node->rand.get(), false);
+        switch (e->e_type) {
+        case E_CAR:
+            emit(OP_CAR);
+            break;
+        case E_CDR:
+            emit(OP_CDR);
+            break;
+        case E_NOT:
+            emit(OP_NOT);
+            break;
+        case E_NULLQ:
+            emit(OP_NULLQ);
+            break;
+        case E_PAIRQ:
+            emit(OP_PAIRQ);
+            break;
+        case E_CALLCC:
+            emit(OP_CALLCC);
+            break;
+        default:
+            emit(OP_PRIM1);
+            emit(reinterpret_cast<intptr_t>(node));
+            break;
+        }
+        break;
+    }
+    default:
+        emit(OP_EVAL);
+        emit(reinterpret_cast<intptr_t>(e));
+        push(1);
+        break;
+    }
+    if (tail)
+        emit(OP_RETURN);
+}
+
+Code* compile(ExprBase* e, Arena& arena)
+{
+    Code* code = arena.make<Code>();
+    Compiler(code).expr(e, true);
+    return code;
+}
+
+/* the caller to go back to on OP_RETURN, owner keeps the code of the caller alive.
+ * a frame with no pc is a call of the memo in owner instead: env holds the arguments
+ * and the value returned through it is stored in the memo on the way back */
+struct CallFrame {
+    const intptr_t* pc;
+    Assoc env;
+    Value owner;
+};
+
+/* closures made by OP_CLOSURE share the code of their lambda */
+static const Code* codeOf(Closure* closure)
+{
+    if (closure->code == nullptr)
+        closure->code = compile(closure->e.get(), closure->form->arena);
+    return closure->code;
+}
+
+static Value run(const Code*, Assoc, Value);
+
+static Value runClosure(Closure* closure, const Assoc& env)
+{
+    return run(codeOf(closure), env, Value(closure));
+}
+
+Value evalVM(ExprBase* e, const Assoc& env)
+{
+    return run(compile(e, ExprArena::current->arena), env, Value(nullptr));
+}
+
+/* GCC and Clang jump straight from one instruction to the next through a table of
+ * label addresses, other compilers go through the switch */
+#if defined(__GNUC__)
+#define VM_THREADED
+#endif
+
+#ifdef VM_THREADED
+#define CASE(op) L_##op
+#define DISPATCH() goto* labels[*pc++]
+#else
+#define CASE(op) case op
+#define DISPATCH() goto dispatch
+#endif
+
+/* fixnum operands have the low bit set */
+#define FIXNUM_BINARY(op, name, result)                \
+    CASE(op):                                          \
+    {                                                  \
+        Value& a = sp[-2];                             \
+        Value& b = sp[-1];                             \
+        if (!(a.bits & b.bits & 1))                    \
+            throw RuntimeError(name ": type error.");  \
+        a = result;                                    \
+        *--sp = Value(nullptr);                        \
+        DISPATCH();                                    \
+    }
+
+/* the operands are proven to be fixnums */
+#define FIXNUMS_BINARY(op, result) \
+    CASE(op):                      \
+    {                              \
+        Value& a = sp[-2];         \
+        Value& b = sp[-1];         \
+        a = result;                \
+        *--sp = Value(nullptr);    \
+        DISPATCH();                \
+    }
+
+/* the errors Apply raises before it evaluates the arguments of a call of f */
+static void checkCallee(const Value& f, int n)
+{
+    switch (f.type()) {
+    case V_PROC:
+        if (static_cast<Closure*>(f.get())->arity != n)
+            throw RuntimeError("apply: wrong number of args.");
+        return;
+    case V_PRIMITIVE: {
+        const Primitive* primitive = static_cast<PrimitiveProc*>(f.get())->primitive;
+        if (n < primitive->min_args || n > primitive->max_args)
+            throw RuntimeError("apply: wrong number of args.");
+        return;
+    }
+    case V_CONT:
+        if (n != 1)
+            throw RuntimeError("apply: wrong number of args.");
+        return;
+    case V_MEMO:
+        return; // its procedure is checked when it is called
+    default:
+        throw RuntimeError("apply: type error.");
+    }
+}
+
+/* frames of calls that are done and referenced from nowhere else, kept by number of
+ * slots so that the next call takes one back instead of allocating a frame */
+const int SPARE_SLOTS = 8;
+const size_t SPARE_FRAMES = 64;
+
+struct SpareFrames {
+    std::vector<Assoc> by_slots[SPARE_SLOTS];
+    Assoc take(int n, const Assoc& next);
+    void give(Assoc& frame);
+};
+
+Assoc SpareFrames::take(int n, const Assoc& next)
+{
+    if (n >= SPARE_SLOTS || by_slots[n].empty())
+        return extend(n, next);
+    Assoc frame = std::move(by_slots[n].back());
+    by_slots[n].pop_back();
+    frame->next = next;
+    return frame;
+}
+
+/* frame is left as it is unless it can be kept */
+void SpareFrames::give(Assoc& frame)
+{
+    AssocList* list = frame.get();
+    if (list == nullptr || list->ref_count != 1 || list->n >= SPARE_SLOTS)
+        return;
+    if (by_slots[list->n].size() >= SPARE_FRAMES)
+        return;
+    for (int i = 0; i < list->n; i++)
+        list->slots()[i] = Value(nullptr);
+    list->next = empty();
+    by_slots[list->n].push_back(std::move(frame));
+}
+
+/* the operand stack holds unset Values above sp, calls push a CallFrame instead of
+ * recursing, so the depth of the program is only limited by memory */
+static Value run(const Code* code, Assoc env, Value owner)
+{
+    std::vector<Value> stack(code->max_stack, Value(nullptr));
+    std::vector<CallFrame> frames;
+    SpareFrames spare;
+    Value* sp = stack.data();
+    const intptr_t* pc = code->ops.data();
+    bool tail;
+
+    auto reserve = [&](int n) {
+        size_t used = sp - stack.data();
+        if (used + n > stack.size()) {
+            stack.resize(std::max(2 * stack.size(), used + n), Value(nullptr));
+            sp = stack.data() + used;
+        }
+    };
+
+#ifdef VM_THREADED
+    static void* const labels[] = {
+        &&L_OP_CONST,
+        &&L_OP_LOCAL,
+        &&L_OP_VAR,
+        &&L_OP_EVAL,
+        &&L_OP_CLOSURE,
+        &&L_OP_POP,
+        &&L_OP_JUMP,
+        &&L_OP_JUMP_FALSE,
+        &&L_OP_LET,
+        &&L_OP_LETREC,
+        &&L_OP_SET_FRAME,
+        &&L_OP_UNLET,
+        &&L_OP_CHECK_CALLEE,
+        &&L_OP_CALL,
+        &&L_OP_TAIL_CALL,
+        &&L_OP_RETURN,
+        &&L_OP_ADD,
+        &&L_OP_SUB,
+        &&L_OP_MUL,
+        &&L_OP_LT,
+        &&L_OP_LE,
+        &&L_OP_NUM_EQ,
+        &&L_OP_GE,
+        &&L_OP_GT,
+        &&L_OP_ADD_FIXNUMS,
+        &&L_OP_SUB_FIXNUMS,
+        &&L_OP_MUL_FIXNUMS,
+        &&L_OP_LT_FIXNUMS,
+        &&L_OP_LE_FIXNUMS,
+        &&L_OP_NUM_EQ_FIXNUMS,
+        &&L_OP_GE_FIXNUMS,
+        &&L_OP_GT_FIXNUMS,
+        &&L_OP_EQ,
+        &&L_OP_CONS,
+        &&L_OP_CAR,
+        &&L_OP_CDR,
+        &&L_OP_NOT,
+        &&L_OP_NULLQ,
+        &&L_OP_PAIRQ,
+        &&L_OP_PRIM1,
+        &&L_OP_CALLCC
+    };
+    DISPATCH();
+#else
+dispatch:
+    switch (*pc++) {
+#endif
+
+    CASE(OP_CONST):
+    {
+        *sp++ = Value::immediate(*pc++);
+        DISPATCH();
+    }
+    CASE(OP_LOCAL):
+    {
+        *sp++ = env->slots()[*pc++];
+        DISPATCH();
+    }
+    CASE(OP_VAR):
+    {
+        *sp++ = find(pc[0], pc[1], env);
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(OP_EVAL):
+    {
+        *sp++ = reinterpret_cast<ExprBase*>(*pc++)->eval(env);
+        DISPATCH();
+    }
+    CASE(OP_CLOSURE):
+    {
+        Lambda* lambda = reinterpret_cast<Lambda*>(*pc++);
+        Value closure = lambda->eval(env);
+        static_cast<Closure*>(closure.get())->code = lambda->code;
+        *sp++ = std::move(closure);
+        DISPATCH();
+    }
+    CASE(OP_POP):
+    {
+        *--sp = Value(nullptr);
+        DISPATCH();
+    }
+    CASE(OP_JUMP):
+    {
+        pc += *pc;
+        DISPATCH();
+    }
+    CASE(OP_JUMP_FALSE):
+    {
+        Value cond = std::move(*--sp);
+        if (cond.bits == Value::FALSE)
+            pc += *pc;
+        else
+            pc++;
+        DISPATCH();
+    }
+    CASE(OP_LET):
+    {
+        int n = *pc++;
+        Assoc frame = extend(n, env);
+        for (int i = n - 1; i >= 0; i--)
+            frame->slots()[i] = std::move(*--sp);
+        env = std::move(frame);
+        DISPATCH();
+    }
+    CASE(OP_LETREC):
+    {
+        int n = *pc++;
+        Assoc frame = extend(n, env);
+        for (int i = 0; i < n; i++)
+            frame->slots()[i] = NothingV();
+        env = std::move(frame);
+        DISPATCH();
+    }
+    CASE(OP_SET_FRAME):
+    {
+        Letrec* node = reinterpret_cast<Letrec*>(*pc++);
+        for (int i = node->bind.size() - 1; i >= 0; i--)
+            env->slots()[i] = std::move(*--sp);
+        node->assigned(env.get());
+        DISPATCH();
+    }
+    CASE(OP_UNLET):
+    {
+        Assoc next = env->next;
+        env = std::move(next);
+        DISPATCH();
+    }
+    CASE(OP_CHECK_CALLEE):
+    {
+        checkCallee(sp[-1], *pc++);
+        DISPATCH();
+    }
+    CASE(OP_CALL):
+    tail = false;
+    goto call;
+    CASE(OP_TAIL_CALL):
+    tail = true;
+call : {
+    /* OP_CHECK_CALLEE has checked f against n */
+    int n = *pc++;
+    Value* f = sp - n - 1;
+callee:
+    if (f->type() != V_PROC) {
+        if (f->type() == V_CONT)
+            escapeTo(static_cast<Continuation*>(f->get()), sp[-1]);
+        Value v(nullptr);
+        if (f->type() == V_MEMO) {
+            Memo* memo = static_cast<Memo*>(f->get());
+            const Value* cached = memo->lookup(f + 1, n);
+            if (cached == nullptr) {
+                /* call its procedure under a memo frame, without recursing */
+                Assoc args = extend(n, empty());
+                for (int i = 0; i < n; i++)
+                    args->slots()[i] = f[1 + i];
+                if (tail)
+                    spare.give(env);
+                else
+                    frames.push_back(CallFrame { pc, std::move(env), std::move(owner) });
+                frames.push_back(CallFrame { nullptr, std::move(args), *f });
+                *f = memo->f;
+                checkCallee(*f, n);
+                tail = true;
+                goto callee;
+            }
+            v = *cached;
+        } else {
+            v = callValue(*f, f + 1, n, runClosure);
+        }
+        /* the value replaces the callee and its arguments, as after a return */
+        while (sp != f + 1)
+            *--sp = Value(nullptr);
+        *f = std::move(v);
+        if (tail)
+            goto ret;
+        DISPATCH();
+    }
+    Closure* closure = static_cast<Closure*>(f->get());
+
+    /* arguments go straight into the new frame, a tail call may hand its own frame over */
+    if (tail)
+        spare.give(env);
+    else
+        frames.push_back(CallFrame { pc, std::move(env), std::move(owner) });
+    Assoc frame = spare.take(n, closure->env);
+    for (int i = 0; i < n; i++)
+        frame->slots()[i] = std::move(f[1 + i]);
+    const Code* callee = codeOf(closure);
+    owner = std::move(*f); // a tail call drops the caller here, callee is kept by owner
+    sp = f;
+    env = std::move(frame);
+    pc = callee->ops.data();
+    reserve(callee->max_stack);
+    DISPATCH();
+}
+    CASE(OP_RETURN):
+ret : {
+    Value v = std::move(*--sp);
+    while (!frames.empty() && frames.back().pc == nullptr) {
+        CallFrame& call = frames.back();
+        static_cast<Memo*>(call.owner.get())->store(call.env->slots(), call.env->n, v);
+        frames.pop_back();
+    }
+    if (frames.empty())
+        return v;
+    CallFrame& caller = frames.back();
+    pc = caller.pc;
+    spare.give(env);
+    env = std::move(caller.env);
+    owner = std::move(caller.owner);
+    frames.pop_back();
+    *sp++ = std::move(v);
+    DISPATCH();
+}
+
+    FIXNUM_BINARY(OP_ADD, "+", IntegerV(a.integer() + b.integer()))
+    FIXNUM_BINARY(OP_SUB, "-", IntegerV(a.integer() - b.integer()))
+    FIXNUM_BINARY(OP_MUL, "*", IntegerV(a.integer() * b.integer()))
+    FIXNUM_BINARY(OP_LT, "<", BooleanV(a.integer() < b.integer()))
+    FIXNUM_BINARY(OP_LE, "<=", BooleanV(a.integer() <= b.integer()))
+    FIXNUM_BINARY(OP_NUM_EQ, "=", BooleanV(a.integer() == b.integer()))
+    FIXNUM_BINARY(OP_GE, ">=", BooleanV(a.integer() >= b.integer()))
+    FIXNUM_BINARY(OP_GT, ">", BooleanV(a.integer() > b.integer()))
+    FIXNUMS_BINARY(OP_ADD_FIXNUMS, IntegerV(a.integer() + b.integer()))
+    FIXNUMS_BINARY(OP_SUB_FIXNUMS, IntegerV(a.integer() - b.integer()))
+    FIXNUMS_BINARY(OP_MUL_FIXNUMS, IntegerV(a.integer() * b.integer()))
+    FIXNUMS_BINARY(OP_LT_FIXNUMS, BooleanV(a.integer() < b.integer()))
+    FIXNUMS_BINARY(OP_LE_FIXNUMS, BooleanV(a.integer() <= b.integer()))
+    FIXNUMS_BINARY(OP_NUM_EQ_FIXNUMS, BooleanV(a.integer() == b.integer()))
+    FIXNUMS_BINARY(OP_GE_FIXNUMS, BooleanV(a.integer() >= b.integer()))
+    FIXNUMS_BINARY(OP_GT_FIXNUMS, BooleanV(a.integer() > b.integer()))
+
+    CASE(OP_EQ):
+    {
+        bool same = sp[-2] == sp[-1];
+        *--sp = Value(nullptr);
+        sp[-1] = BooleanV(same);
+        DISPATCH();
+    }
+    CASE(OP_CONS):
+    {
+        Value pair = PairV(sp[-2], sp[-1]);
+        *--sp = Value(nullptr);
+        sp[-1] = std::move(pair);
+        DISPATCH();
+    }
+    CASE(OP_CAR):
+    {
+        if (sp[-1].type() != V_PAIR)
+            throw RuntimeError("car: type error.");
+        Value car = static_cast<Pair*>(sp[-1].get())->car;
+        sp[-1] = std::move(car);
+        DISPATCH();
+    }
+    CASE(OP_CDR):
+    {
+        if (sp[-1].type() != V_PAIR)
+            throw RuntimeError("cdr: type error.");
+        Value cdr = static_cast<Pair*>(sp[-1].get())->cdr;
+        sp[-1] = std::move(cdr);
+        DISPATCH();
+    }
+    CASE(OP_NOT):
+    {
+        sp[-1] = BooleanV(sp[-1].bits == Value::FALSE);
+        DISPATCH();
+    }
+    CASE(OP_NULLQ):
+    {
+        sp[-1] = BooleanV(sp[-1].bits == Value::NIL);
+        DISPATCH();
+    }
+    CASE(OP_PAIRQ):
+    {
+        sp[-1] = BooleanV(sp[-1].type() == V_PAIR);
+        DISPATCH();
+    }
+    CASE(OP_PRIM1):
+    {
+        Unary* node = reinterpret_cast<Unary*>(*pc++);
+        sp[-1] = node->evalRator(sp[-1]);
+        DISPATCH();
+    }
+    CASE(OP_CALLCC):
+    {
+        Value f = std::move(sp[-1]);
+        sp[-1] = callEscape(f, runClosure);
+        DISPATCH();
+    }
+
+#ifndef VM_THREADED
+    }
+    return Value(nullptr);
+#endif
+}
@@ -0,0 +1,65 @@
+#ifndef BYTECODE_VM
+#define BYTECODE_VM
+
+#include "Def.hpp"
+#include "arena.hpp"
+#include "expr.hpp"
+#include <cstdint>
+#include <vector>
+
+/* bytecode for the VM engine: a flat array of words, each instruction is its opcode
+ * followed by its operands; jumps are relative to the word holding the offset */
+enum OpCode {
+    OP_CONST, // bits: push an immediate Value
+    OP_LOCAL, // index: push a slot of the current frame
+    OP_VAR, // depth index: push a slot of an outer frame
+    OP_EVAL, // node: push node->eval(env), for leaves the VM has no instruction for
+    OP_CLOSURE, // lambda: push a closure of env
+    OP_POP,
+    OP_JUMP, // offset
+    OP_JUMP_FALSE, // offset: pop, jump if it is #f
+    OP_LET, // n: pop n values into a new frame
+    OP_LETREC, // n: enter a new frame of n unassigned slots
+    OP_SET_FRAME, // letrec: pop the values of its bindings into the current frame
+    OP_UNLET, // leave the current frame
+    OP_CHECK_CALLEE, // n: raise the errors of calling the top with n arguments, before they run
+    OP_CALL, // n: call the closure below n arguments
+    OP_TAIL_CALL, // n: the same, reusing the current call
+    OP_RETURN,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_LT,
+    OP_LE,
+    OP_NUM_EQ,
+    OP_GE,
+    OP_GT,
+    OP_ADD_FIXNUMS, // the same, on operands proven to be fixnums
+    OP_SUB_FIXNUMS,
+    OP_MUL_FIXNUMS,
+    OP_LT_FIXNUMS,
+    OP_LE_FIXNUMS,
+    OP_NUM_EQ_FIXNUMS,
+    OP_GE_FIXNUMS,
+    OP_GT_FIXNUMS,
+    OP_EQ,
+    OP_CONS,
+    OP_CAR,
+    OP_CDR,
+    OP_NOT,
+    OP_NULLQ,
+    OP_PAIRQ,
+    OP_PRIM1, // node: the Unary's evalRator on the top
+    OP_CALLCC
+};
+
+struct Code {
+    std::vector<intptr_t> ops;
+    int max_stack; // operand stack slots the code uses at most
+    Code();
+};
+
+/* compile a form or a lambda body into arena, the code ends in tail position */
+Code* compile(ExprBase*, Arena&);
+
+#endif